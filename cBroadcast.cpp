@@ -0,0 +1,38 @@
+#include <algorithm>
+
+#include "cBroadcast.h"
+
+void cBroadcast::Add( cNonBlockingTCPClient& client )
+{
+    if( std::find( myMembers.begin(), myMembers.end(), &client ) == myMembers.end() )
+        myMembers.push_back( &client );
+}
+
+void cBroadcast::Remove( cNonBlockingTCPClient& client )
+{
+    myMembers.erase(
+        std::remove( myMembers.begin(), myMembers.end(), &client ),
+        myMembers.end() );
+}
+
+int cBroadcast::Send(
+    int type,
+    const std::vector< boost::asio::const_buffer >& parts )
+{
+    return Send( EncodeFrame( type, parts ) );
+}
+
+int cBroadcast::Send( frame_buffer_t frame )
+{
+    int count = 0;
+    for( cNonBlockingTCPClient * client : myMembers )
+    {
+        if( ! client->IsConnected() )
+            continue;
+
+        // every connection holds a reference to the same buffer
+        client->Send( frame );
+        count++;
+    }
+    return count;
+}
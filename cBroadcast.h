@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+
+#include "cNonBlockingTCPClient.h"
+
+/** Group of connections that can be sent the same frame
+
+    The frame is encoded once into a reference counted buffer
+    and that one buffer is queued on every connection in the group.
+    The buffer is freed when the last connection has finished with it.
+    Fan out to N connections costs one encode and N queue pushes.
+*/
+class cBroadcast
+{
+public:
+
+    /// Add connection to group
+    void Add( cNonBlockingTCPClient& client );
+
+    /// Remove connection from group
+    void Remove( cNonBlockingTCPClient& client );
+
+    /** Send frame to every connected member of the group
+        @param[in] type payload type
+        @param[in] parts buffers concatenated to form the payload
+        @return number of connections the frame was queued on
+    */
+    int Send(
+        int type,
+        const std::vector< boost::asio::const_buffer >& parts );
+
+    /** Send already encoded frame to every connected member of the group
+        @param[in] frame
+        @return number of connections the frame was queued on
+    */
+    int Send( frame_buffer_t frame );
+
+    std::size_t Size() const
+    {
+        return myMembers.size();
+    }
+
+private:
+    std::vector< cNonBlockingTCPClient * > myMembers;
+};
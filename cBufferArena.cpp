@@ -0,0 +1,132 @@
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "cBufferArena.h"
+
+cBufferArena::cBufferArena(
+    std::size_t bytes,
+    int node )
+    : myBase( 0 )
+    , myUsed( 0 )
+    , myBacking( backing::heap )
+    , myNode( node )
+{
+    myCapacity = ( ( bytes + ARENA_HUGE_PAGE_BYTES - 1 ) / ARENA_HUGE_PAGE_BYTES )
+                 * ARENA_HUGE_PAGE_BYTES;
+
+#ifdef __linux__
+    void * p = mmap(
+                   0, myCapacity,
+                   PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                   -1, 0 );
+    if( p != MAP_FAILED )
+    {
+        myBacking = backing::hugetlb;
+    }
+    else
+    {
+        // no reserved huge pages, ask for transparent huge pages
+        p = mmap(
+                0, myCapacity,
+                PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS,
+                -1, 0 );
+        if( p != MAP_FAILED )
+        {
+            madvise( p, myCapacity, MADV_HUGEPAGE );
+            myBacking = backing::thp;
+        }
+    }
+    if( myBacking != backing::heap )
+    {
+        myBase = (unsigned char *) p;
+        BindToNode();
+    }
+#endif
+
+    if( ! myBase )
+    {
+        myBase = (unsigned char *) malloc( myCapacity );
+        myBacking = backing::heap;
+    }
+    if( ! myBase )
+    {
+        // an empty arena, every Allocate() fails and users fall back to the heap
+        std::cout << "Buffer arena of " << myCapacity << " bytes unavailable\n";
+        myCapacity = 0;
+        return;
+    }
+
+    // fault the pages in now, on the bound node, rather than in the receive path
+    memset( myBase, 0, myCapacity );
+}
+
+cBufferArena::~cBufferArena()
+{
+#ifdef __linux__
+    if( myBacking != backing::heap )
+    {
+        munmap( myBase, myCapacity );
+        return;
+    }
+#endif
+    free( myBase );
+}
+
+void cBufferArena::BindToNode()
+{
+#ifdef __linux__
+    if( myNode < 0 || myNode >= 64 )
+        return;
+
+    // mbind directly so there is no dependency on libnuma
+    const int MPOL_PREFERRED = 1;
+    unsigned long nodemask = 1UL << myNode;
+
+    // the kernel takes maxnode - 1 bits of the mask, so one more than it holds
+    syscall(
+        SYS_mbind,
+        myBase, myCapacity,
+        MPOL_PREFERRED,
+        &nodemask, 8 * sizeof( nodemask ) + 1,
+        0 );
+#endif
+}
+
+void * cBufferArena::Allocate(
+    std::size_t bytes,
+    std::size_t align )
+{
+    std::lock_guard<std::mutex> lck (myMutex);
+    std::size_t start = ( myUsed + align - 1 ) & ~( align - 1 );
+    if( start + bytes > myCapacity )
+        return 0;
+    myUsed = start + bytes;
+    return myBase + start;
+}
+
+std::size_t cBufferArena::Used()
+{
+    std::lock_guard<std::mutex> lck (myMutex);
+    return myUsed;
+}
+
+const char * cBufferArena::BackingText() const
+{
+    switch( myBacking )
+    {
+    case backing::hugetlb:
+        return "huge pages";
+    case backing::thp:
+        return "transparent huge pages";
+    default:
+        return "heap";
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+
+/// huge page size used to back arenas
+#define ARENA_HUGE_PAGE_BYTES ( 2 * 1024 * 1024 )
+
+/** Arena of buffer memory backed, where possible, by 2 MB huge pages
+
+    Frame slot pools are carved from the arena, so the frame payloads and raw read buffers
+    taken from them keep the hot receive and decode path to a handful of TLB entries
+    instead of one per 4 KB page.
+
+    The backing is chosen in this order
+
+    - explicit huge pages ( mmap MAP_HUGETLB ), needs pages reserved in /proc/sys/vm/nr_hugepages
+    - transparent huge pages ( mmap then madvise MADV_HUGEPAGE )
+    - ordinary heap
+
+    Memory is placed on the requested NUMA node before it is first touched.
+
+    Allocations are never returned individually, the whole arena is released in the DTOR.
+*/
+class cBufferArena
+{
+public:
+
+    enum class backing
+    {
+        hugetlb,        /// explicit huge pages
+        thp,            /// transparent huge pages
+        heap            /// ordinary heap, no huge page support
+    };
+
+    /** CTOR
+        @param[in] bytes capacity, rounded up to a whole number of huge pages
+        @param[in] node NUMA node the memory is to be placed on, -1 for no preference
+    */
+    cBufferArena(
+        std::size_t bytes,
+        int node = -1 );
+
+    ~cBufferArena();
+
+    /** Allocate from arena ( thread safe )
+        @param[in] bytes required
+        @param[in] align alignment, power of 2.  Default is a cache line
+        @return pointer to memory, or 0 if arena exhausted
+    */
+    void * Allocate(
+        std::size_t bytes,
+        std::size_t align = 64 );
+
+    std::size_t Capacity() const
+    {
+        return myCapacity;
+    }
+    std::size_t Used();
+
+    backing Backing() const
+    {
+        return myBacking;
+    }
+
+    /// human readable description of backing
+    const char * BackingText() const;
+
+    int Node() const
+    {
+        return myNode;
+    }
+
+private:
+    unsigned char * myBase;
+    std::size_t myCapacity;
+    std::size_t myUsed;
+    backing myBacking;
+    int myNode;
+    std::mutex myMutex;
+
+    void BindToNode();
+};
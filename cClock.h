@@ -0,0 +1,127 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+/** Clock that the event manager's timers run on, real or virtual
+
+    Timers declared as event_timer_t take their time from here.
+    Normally that is the system clock.
+
+    In virtual time, the clock stands still until the event manager
+    has nothing to do but wait for the next timer, and then jumps straight to it.
+    Hours of timer behaviour run in milliseconds, and always in the same order.
+    Use virtual time only where nothing waits on real I/O.
+
+    asio asks the clock how long to wait for the earliest timer.  In virtual time
+    the answer is always zero, and the earliest deadline is remembered so that
+    Run() can jump to it once everything ready has been done.
+*/
+class cClock
+{
+public:
+
+    /// asio time traits, for boost::asio::basic_deadline_timer
+    struct traits
+    {
+        typedef boost::posix_time::ptime time_type;
+        typedef boost::posix_time::time_duration duration_type;
+
+        static time_type now()
+        {
+            if( Virtual() )
+                return VirtualNow();
+            return boost::posix_time::microsec_clock::universal_time();
+        }
+
+        static time_type add( const time_type& t, const duration_type& d )
+        {
+            return t + d;
+        }
+
+        static duration_type subtract( const time_type& t1, const time_type& t2 )
+        {
+            return t1 - t2;
+        }
+
+        static bool less_than( const time_type& t1, const time_type& t2 )
+        {
+            return t1 < t2;
+        }
+
+        static boost::posix_time::time_duration to_posix_duration( const duration_type& d )
+        {
+            if( ! Virtual() )
+                return d;
+
+            // asio has just subtracted now() from the earliest deadline
+            Next() = VirtualNow() + d;
+            return boost::posix_time::time_duration();
+        }
+    };
+
+    /** Switch to virtual time
+        @param[in] f true for virtual time
+
+        Call before any timer is started.  Virtual time starts from the real time.
+    */
+    static void UseVirtual( bool f )
+    {
+        VirtualNow() = boost::posix_time::microsec_clock::universal_time();
+        Next() = VirtualNow();
+        Virtual() = f;
+    }
+
+    static bool IsVirtual()
+    {
+        return Virtual();
+    }
+
+    /// current time
+    static boost::posix_time::ptime Now()
+    {
+        return traits::now();
+    }
+
+    /** Run the event manager in virtual time
+        @param[in] io_service
+
+        Does everything ready, then jumps to the next timer, until nothing is left or the event manager is stopped.
+    */
+    static void Run( boost::asio::io_service& io_service )
+    {
+        while( ! io_service.stopped() )
+        {
+            if( io_service.poll() )
+                continue;
+            if( ! ( VirtualNow() < Next() ))
+                return;
+            VirtualNow() = Next();
+        }
+    }
+
+private:
+
+    static bool& Virtual()
+    {
+        static bool f = false;
+        return f;
+    }
+
+    static boost::posix_time::ptime& VirtualNow()
+    {
+        static boost::posix_time::ptime t;
+        return t;
+    }
+
+    /// earliest deadline when asio last asked
+    static boost::posix_time::ptime& Next()
+    {
+        static boost::posix_time::ptime t;
+        return t;
+    }
+};
+
+/// timer driven by cClock
+typedef boost::asio::basic_deadline_timer<
+boost::posix_time::ptime,
+cClock::traits > event_timer_t;
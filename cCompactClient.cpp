@@ -0,0 +1,396 @@
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <boost/bind.hpp>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#include "cCompactClient.h"
+
+cCompactClient::cCompactClient(
+    boost::asio::io_service& io_service,
+    cFrameSlotPool& pool,
+    unsigned int keepalive_msecs )
+    : myIOService( io_service )
+#ifdef __linux__
+    , myEpoll( io_service )
+#endif
+    , mySweepTimer( io_service )
+    , myPool( pool )
+    , mySource( 0 )
+    , myScratch( pool.SlotBytes() )
+    , myEpoch( cClock::Now() )
+    , myKeepaliveMsecs( keepalive_msecs )
+    , myConnections( 0 )
+    , myfStopped( false )
+    , myFramesRead( 0 )
+    , myKeepalivesSent( 0 )
+    , mySweeps( 0 )
+    , mySweepNsecs( 0 )
+{
+    myKeepalive.Set( FRAME_TYPE_KEEPALIVE, 0 );
+#ifdef __linux__
+    int fd = epoll_create1( EPOLL_CLOEXEC );
+    if( fd < 0 )
+    {
+        std::cout << "Compact client cannot create epoll instance\n";
+        return;
+    }
+    myEpoll.assign( fd );
+    Wait();
+    mySweepTimer.expires_from_now( boost::posix_time::milliseconds( COMPACT_SWEEP_MSECS ));
+    mySweepTimer.async_wait( boost::bind( &cCompactClient::handle_sweep, this,
+                                          boost::asio::placeholders::error ));
+#endif
+}
+
+cCompactClient::~cCompactClient()
+{
+    for( int slot = 0; slot < (int)myFD.size(); slot++ )
+        if( myState[ slot ] != slot_free )
+            Close( slot );
+}
+
+std::uint32_t cCompactClient::Now() const
+{
+    // the sweep timer runs on cClock, so activity is timed on it too
+    return (std::uint32_t) ( cClock::Now() - myEpoch ).total_milliseconds();
+}
+
+int cCompactClient::Connect(
+    const std::string& ip,
+    const std::string& port )
+{
+#ifdef __linux__
+    if( ! myEpoll.is_open() || myfStopped )
+        return -1;
+    boost::system::error_code ec;
+    boost::asio::ip::tcp::resolver resolver( myIOService );
+    boost::asio::ip::tcp::resolver::query query( ip, port );
+    boost::asio::ip::tcp::resolver::iterator it = resolver.resolve( query, ec );
+    if( ec )
+        return -1;
+    boost::asio::ip::tcp::endpoint server = *it;
+
+    int fd = -1;
+    for( int attempt = 0; attempt < SOURCE_BIND_ATTEMPTS; attempt++ )
+    {
+        fd = socket( server.protocol().family(), SOCK_STREAM | SOCK_CLOEXEC, 0 );
+        if( fd < 0 )
+        {
+            std::cout << "Compact client socket failed: " << strerror( errno ) << "\n";
+            return -1;
+        }
+        int error = mySource && ! mySource->Empty() ? mySource->Bind( fd, server ) : 0;
+        if( error == EADDRINUSE )
+        {
+            // the source port is taken, try the next
+            close( fd );
+            fd = -1;
+            continue;
+        }
+        if( error )
+        {
+            std::cout << "Compact client cannot bind to a source: " << strerror( error ) << "\n";
+            close( fd );
+            return -1;
+        }
+        if( ! connect( fd, server.data(), server.size() ))
+            break;
+        error = errno;
+        close( fd );
+        fd = -1;
+        if( ! mySource || ! mySource->Failed( error ))
+        {
+            std::cout << "Compact client connection failed: " << strerror( error ) << "\n";
+            return -1;
+        }
+    }
+    if( fd < 0 )
+    {
+        std::cout << "Compact client found no free source port\n";
+        return -1;
+    }
+    int one = 1;
+    setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ));
+    int flags = 1;
+    ioctl( fd, FIONBIO, &flags );
+
+    int slot;
+    if( myFree.size() )
+    {
+        slot = myFree.back();
+        myFree.pop_back();
+    }
+    else
+    {
+        slot = (int)myFD.size();
+        myFD.push_back( -1 );
+        myLastActivity.push_back( 0 );
+        myState.push_back( slot_free );
+        myHeaderFill.push_back( 0 );
+        myHeader.push_back( cFrameHeader() );
+        myPayloadFill.push_back( 0 );
+        myPartial.push_back( 0 );
+        myDeficit.push_back( 0 );
+    }
+
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = 0;
+    ev.data.u32 = slot;
+    if( epoll_ctl( myEpoll.native_handle(), EPOLL_CTL_ADD, fd, &ev ))
+    {
+        close( fd );
+        myFree.push_back( slot );
+        return -1;
+    }
+
+    myFD[ slot ] = fd;
+    myLastActivity[ slot ] = Now();
+    myState[ slot ] = slot_open;
+    myHeaderFill[ slot ] = 0;
+    myPayloadFill[ slot ] = 0;
+    myPartial[ slot ] = 0;
+    myDeficit[ slot ] = 0;
+    myConnections++;
+    return slot;
+#else
+    return -1;
+#endif
+}
+
+void cCompactClient::Close( int slot )
+{
+    if( myState[ slot ] == slot_free )
+        return;
+#ifdef __linux__
+    // closing the last descriptor of the socket removes it from epoll
+    close( myFD[ slot ] );
+#endif
+    myPool.Release( myPartial[ slot ] );
+    myPartial[ slot ] = 0;
+    myFD[ slot ] = -1;
+    myState[ slot ] = slot_free;
+    myFree.push_back( slot );
+    myConnections--;
+}
+
+void cCompactClient::Stop()
+{
+    myfStopped = true;
+    for( int slot = 0; slot < (int)myFD.size(); slot++ )
+        Close( slot );
+    boost::system::error_code ec;
+    mySweepTimer.cancel( ec );
+#ifdef __linux__
+    myEpoll.cancel( ec );
+#endif
+}
+
+void cCompactClient::Wait()
+{
+#ifdef __linux__
+    myEpoll.async_wait(
+        boost::asio::posix::stream_descriptor::wait_read,
+        boost::bind( &cCompactClient::handle_ready, this,
+                     boost::asio::placeholders::error ));
+#endif
+}
+
+void cCompactClient::handle_ready( const boost::system::error_code& error )
+{
+    if( error || myfStopped )
+        return;
+#ifdef __linux__
+    // one batch per turn, so a flood on many connections cannot hold the event manager.
+    // epoll reports ready sockets round robin, those not in this batch come first next time
+    epoll_event events[ COMPACT_EPOLL_BATCH ];
+    int n = epoll_wait( myEpoll.native_handle(), events, COMPACT_EPOLL_BATCH, 0 );
+    for( int k = 0; k < n; k++ )
+    {
+        int slot = events[k].data.u32;
+        if( myState[ slot ] != slot_free )
+            Read( slot );
+    }
+#endif
+    Wait();
+}
+
+void cCompactClient::Read( int slot )
+{
+#ifdef __linux__
+    int fd = myFD[ slot ];
+
+    // this turn's budget, deficit round robin as cFairScheduler
+    int frames = 0;
+    myDeficit[ slot ] += FAIR_QUANTUM_BYTES;
+    if( myDeficit[ slot ] > 2 * FAIR_QUANTUM_BYTES )
+        myDeficit[ slot ] = 2 * FAIR_QUANTUM_BYTES;
+
+    // epoll is level triggered, so whatever is left when the budget is spent is reported again
+    while( myDeficit[ slot ] > 0 )
+    {
+        ssize_t n;
+        if( myHeaderFill[ slot ] < FRAME_HEADER_BYTES )
+        {
+            n = recv( fd, myHeader[ slot ].myBytes + myHeaderFill[ slot ],
+                      FRAME_HEADER_BYTES - myHeaderFill[ slot ], 0 );
+            if( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ))
+                return;
+            if( n <= 0 )
+            {
+                Close( slot );
+                return;
+            }
+            myHeaderFill[ slot ] += n;
+            if( myHeaderFill[ slot ] < FRAME_HEADER_BYTES )
+                continue;
+            if( ! myHeader[ slot ].IsValid() || myHeader[ slot ].Length() > myPool.SlotBytes() )
+            {
+                std::cout << "Compact client invalid frame header\n";
+                Close( slot );
+                return;
+            }
+            myPayloadFill[ slot ] = 0;
+            if( ! myHeader[ slot ].Length() )
+            {
+                Dispatch( slot, 0, 0 );
+                if( myState[ slot ] == slot_free || Spent( slot, 0, frames ))
+                    return;
+                continue;
+            }
+        }
+
+        std::size_t length = myHeader[ slot ].Length();
+        if( ! myPartial[ slot ] )
+        {
+            // usually the whole payload is there, so it needs no buffer of the connection's own
+            n = recv( fd, myScratch.data(), length, 0 );
+            if( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ))
+                return;
+            if( n <= 0 )
+            {
+                Close( slot );
+                return;
+            }
+            if( (std::size_t)n == length )
+            {
+                // the handler may have closed the connection
+                Dispatch( slot, myScratch.data(), length );
+                if( myState[ slot ] == slot_free || Spent( slot, length, frames ))
+                    return;
+                continue;
+            }
+
+            // split across reads, borrow a slot to collect it in
+            myPartial[ slot ] = myPool.Acquire();
+            if( ! myPartial[ slot ] )
+            {
+                std::cout << "Compact client frame slot pool exhausted\n";
+                Close( slot );
+                return;
+            }
+            memcpy( myPartial[ slot ], myScratch.data(), n );
+            myPayloadFill[ slot ] = n;
+            continue;
+        }
+
+        n = recv( fd, myPartial[ slot ] + myPayloadFill[ slot ],
+                  length - myPayloadFill[ slot ], 0 );
+        if( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ))
+            return;
+        if( n <= 0 )
+        {
+            Close( slot );
+            return;
+        }
+        myPayloadFill[ slot ] += n;
+        if( myPayloadFill[ slot ] < length )
+            continue;
+        unsigned char * payload = myPartial[ slot ];
+        myPartial[ slot ] = 0;
+        Dispatch( slot, payload, length );
+        myPool.Release( payload );
+        if( myState[ slot ] == slot_free || Spent( slot, length, frames ))
+            return;
+    }
+#endif
+}
+
+bool cCompactClient::Spent(
+    int slot,
+    std::size_t length,
+    int& frames )
+{
+    myDeficit[ slot ] -= FRAME_HEADER_BYTES + length;
+    frames++;
+    return myDeficit[ slot ] <= 0 || frames >= FAIR_FRAME_BUDGET;
+}
+
+void cCompactClient::Dispatch(
+    int slot,
+    const unsigned char * payload,
+    std::size_t length )
+{
+    myHeaderFill[ slot ] = 0;
+    myLastActivity[ slot ] = Now();
+    myState[ slot ] = slot_open;
+    myFramesRead++;
+    int type = myHeader[ slot ].Type();
+    if( type != FRAME_TYPE_KEEPALIVE && myFrameHandler )
+        myFrameHandler( slot, type, payload, length );
+}
+
+void cCompactClient::handle_sweep( const boost::system::error_code& error )
+{
+    if( error || myfStopped )
+        return;
+#ifdef __linux__
+    timespec start, end;
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID, &start );
+
+    std::uint32_t now = Now();
+    for( int slot = 0; slot < (int)myState.size() && myKeepaliveMsecs; slot++ )
+    {
+        std::uint8_t state = myState[ slot ];
+        if( state == slot_free )
+            continue;
+        std::uint32_t idle = now - myLastActivity[ slot ];
+        if( state == slot_open && idle >= myKeepaliveMsecs )
+        {
+            ssize_t n = send( myFD[ slot ], myKeepalive.myBytes, FRAME_HEADER_BYTES,
+                              MSG_DONTWAIT | MSG_NOSIGNAL );
+            if( n == FRAME_HEADER_BYTES )
+            {
+                myState[ slot ] = slot_keepalive;
+                myKeepalivesSent++;
+            }
+            else if( ! ( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK )))
+            {
+                // a partly sent keepalive would corrupt the stream
+                Close( slot );
+            }
+        }
+        else if( state == slot_keepalive && idle >= 3 * myKeepaliveMsecs )
+        {
+            // no answer to the keepalive, the server or the path to it is gone
+            Close( slot );
+        }
+    }
+
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID, &end );
+    mySweepNsecs += ( end.tv_sec - start.tv_sec ) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+    mySweeps++;
+#endif
+    mySweepTimer.expires_from_now( boost::posix_time::milliseconds( COMPACT_SWEEP_MSECS ));
+    mySweepTimer.async_wait( boost::bind( &cCompactClient::handle_sweep, this,
+                                          boost::asio::placeholders::error ));
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <boost/asio.hpp>
+
+#include "cClock.h"
+#include "cSourcePool.h"
+#include "cFairScheduler.h"
+#include "frame.h"
+
+// payload type of a keepalive frame, empty payload, the server answers with the same
+#define FRAME_TYPE_KEEPALIVE 0xF005
+
+// msecs between sweeps of the slot table for keepalives and dead connections
+#define COMPACT_SWEEP_MSECS 1000
+
+// most readiness events collected from epoll at once
+#define COMPACT_EPOLL_BATCH 256
+
+/** Many connections to one server, each with a footprint of a few tens of bytes
+
+    For holding very large numbers of mostly idle connections, C100K, where a
+    cNonBlockingTCPClient per connection would cost hundreds of bytes of object,
+    an asio socket and its reactor state, and a buffer.
+
+    Each connection is a slot in a table kept as structure-of-arrays:
+    socket, last activity, state and the progress of the frame being read.
+    Every socket is registered with one epoll instance, and only that instance
+    is registered with the event manager.
+
+    No connection has a buffer of its own.  A frame that arrives whole is read into
+    a scratch buffer shared by all connections.  Only a frame split across reads
+    borrows a slot from the frame slot pool, until it completes.
+
+    No connection has a timer.  One sweep of the table every COMPACT_SWEEP_MSECS
+    sends a keepalive on connections quiet for the keepalive time,
+    and closes those that stay quiet for three times that.
+
+    Each time a connection is read it may take FAIR_QUANTUM_BYTES,
+    or FAIR_FRAME_BUDGET frames, before the next ready connection is read,
+    so one flooding connection cannot starve the quiet ones.
+
+    Linux only.  Not thread safe, use from the event manager thread.
+*/
+class cCompactClient
+{
+public:
+
+    /** Called when a complete frame has been read
+
+        @param[in] slot of connection
+        @param[in] type of payload
+        @param[in] payload valid only until the handler returns
+        @param[in] length of payload
+    */
+    typedef std::function< void(
+        int slot,
+        int type,
+        const unsigned char * payload,
+        std::size_t length ) > frame_handler_t;
+
+    /** CTOR
+        @param[in] io_service the event manager
+        @param[in] pool frame slot pool that split frames borrow from
+        @param[in] keepalive_msecs quiet time after which a keepalive is sent, 0 for none
+    */
+    cCompactClient(
+        boost::asio::io_service& io_service,
+        cFrameSlotPool& pool,
+        unsigned int keepalive_msecs );
+
+    ~cCompactClient();
+
+    /// Register frame handler, keepalive answers are not passed on
+    void FrameHandler( frame_handler_t handler )
+    {
+        myFrameHandler = handler;
+    }
+
+    /** Bind connections to local addresses from a pool
+        @param[in] pool of source addresses, 0 to leave the choice to the kernel
+    */
+    void SourcePool( cSourcePool * pool )
+    {
+        mySource = pool;
+    }
+
+    /** Connect a new connection to server
+        @param[in] ip address of server
+        @param[in] port server is listening to for connections
+        @return slot of connection, or -1 if connection failed
+
+        Like cNonBlockingTCPClient::Connect() this blocks until the connection succeeds or fails.
+    */
+    int Connect(
+        const std::string& ip,
+        const std::string& port );
+
+    /// Close connection, the slot is reused
+    void Close( int slot );
+
+    /// Close all connections and stop, so the event manager can finish
+    void Stop();
+
+    /// Number of open connections
+    int Connections() const
+    {
+        return myConnections;
+    }
+
+    /// Table bytes used by each connection
+    static std::size_t BytesPerSlot()
+    {
+        return sizeof( int ) + sizeof( std::uint32_t ) + sizeof( std::uint8_t )
+               + sizeof( std::uint8_t ) + sizeof( cFrameHeader )
+               + sizeof( std::uint32_t ) + sizeof( unsigned char * )
+               + sizeof( std::int32_t );
+    }
+
+    unsigned long long FramesRead() const
+    {
+        return myFramesRead;
+    }
+    unsigned long long KeepalivesSent() const
+    {
+        return myKeepalivesSent;
+    }
+    unsigned long long Sweeps() const
+    {
+        return mySweeps;
+    }
+
+    /// CPU time spent sweeping, nanoseconds
+    unsigned long long SweepNsecs() const
+    {
+        return mySweepNsecs;
+    }
+
+private:
+
+    /// connection state
+    enum : std::uint8_t
+    {
+        slot_free,
+        slot_open,                      /// connected
+        slot_keepalive                  /// keepalive sent, waiting for any frame
+    };
+
+    // the slot table, one entry per connection in each array
+    std::vector< int > myFD;
+    std::vector< std::uint32_t > myLastActivity;     /// msecs since construction
+    std::vector< std::uint8_t > myState;
+    std::vector< std::uint8_t > myHeaderFill;        /// header bytes read
+    std::vector< cFrameHeader > myHeader;
+    std::vector< std::uint32_t > myPayloadFill;      /// payload bytes read into borrowed slot
+    std::vector< unsigned char * > myPartial;        /// borrowed slot holding split payload, or 0
+    std::vector< std::int32_t > myDeficit;           /// bytes carried to next turn, negative if overspent
+    std::vector< int > myFree;
+
+    boost::asio::io_service& myIOService;
+#ifdef __linux__
+    boost::asio::posix::stream_descriptor myEpoll;  /// epoll instance, readable when a socket is
+#endif
+    event_timer_t mySweepTimer;
+    cFrameSlotPool& myPool;
+    cSourcePool * mySource;                         /// local addresses to bind to, or 0
+    std::vector< unsigned char > myScratch;         /// payloads that arrive whole
+    cFrameHeader myKeepalive;                       /// keepalive frame, header only
+    frame_handler_t myFrameHandler;
+    boost::posix_time::ptime myEpoch;               /// construction, on cClock
+    unsigned int myKeepaliveMsecs;
+    int myConnections;
+    bool myfStopped;
+    unsigned long long myFramesRead;
+    unsigned long long myKeepalivesSent;
+    unsigned long long mySweeps;
+    unsigned long long mySweepNsecs;
+
+    /// msecs since construction on cClock, wraps after 49 days
+    std::uint32_t Now() const;
+
+    /// wait for a socket to become readable
+    void Wait();
+
+    void handle_ready( const boost::system::error_code& error );
+
+    /// read what has arrived on connection
+    void Read( int slot );
+
+    /** Charge a dispatched frame to the connection's turn
+        @param[in] slot of connection
+        @param[in] length of payload
+        @param[in,out] frames read this turn
+        @return true if the turn's budget is spent
+    */
+    bool Spent(
+        int slot,
+        std::size_t length,
+        int& frames );
+
+    /// complete frame has been read
+    void Dispatch(
+        int slot,
+        const unsigned char * payload,
+        std::size_t length );
+
+    void handle_sweep( const boost::system::error_code& error );
+};
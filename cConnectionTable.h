@@ -0,0 +1,122 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+#include "cClock.h"
+
+/** Table of connections kept as contiguous structure-of-arrays
+
+    Sweeps such as timeout checks walk only the arrays they need,
+    so checking thousands of connections reads a few contiguous cache lines
+    rather than chasing a pointer to every connection object.
+
+    Not thread safe, use from the event manager thread.
+*/
+class cConnectionTable
+{
+public:
+
+    cConnectionTable()
+        : myEpoch( cClock::Now() )
+    {
+
+    }
+
+    /** Add connection
+        @param[in] owner the connection object
+        @return slot index
+    */
+    int Add( void * owner )
+    {
+        int slot;
+        if( myFree.size() )
+        {
+            slot = myFree.back();
+            myFree.pop_back();
+        }
+        else
+        {
+            slot = (int)myOwner.size();
+            myOwner.push_back( 0 );
+            myLastActivity.push_back( 0 );
+            myState.push_back( 0 );
+        }
+        myOwner[ slot ] = owner;
+        myState[ slot ] = 0;
+        Touch( slot );
+        return slot;
+    }
+
+    /// Remove connection, slot is reused
+    void Remove( int slot )
+    {
+        myOwner[ slot ] = 0;
+        myState[ slot ] = 0;
+        myFree.push_back( slot );
+    }
+
+    /// Record activity on connection now
+    void Touch( int slot )
+    {
+        myLastActivity[ slot ] = Now();
+    }
+
+    /// Set connection state, application defined
+    void State( int slot, std::uint8_t state )
+    {
+        myState[ slot ] = state;
+    }
+    std::uint8_t State( int slot ) const
+    {
+        return myState[ slot ];
+    }
+
+    void * Owner( int slot ) const
+    {
+        return myOwner[ slot ];
+    }
+
+    /** Find connections idle too long
+        @param[in] idle_msecs idle time that expires a connection
+        @param[in] expired called with slot of each expired connection
+        @return number of expired connections
+    */
+    int Sweep(
+        unsigned int idle_msecs,
+        std::function< void( int slot ) > expired )
+    {
+        std::uint32_t now = Now();
+        int count = 0;
+        for( int slot = 0; slot < (int)myLastActivity.size(); slot++ )
+        {
+            if( now - myLastActivity[ slot ] < idle_msecs )
+                continue;
+            if( ! myOwner[ slot ] )
+                continue;
+            expired( slot );
+            count++;
+        }
+        return count;
+    }
+
+    /// Table bytes used by each connection
+    static std::size_t BytesPerSlot()
+    {
+        return sizeof( void * ) + sizeof( std::uint32_t ) + sizeof( std::uint8_t );
+    }
+
+    /// Msecs since table was constructed, on cClock like the sweeps' timers, wraps after 49 days
+    std::uint32_t Now() const
+    {
+        return (std::uint32_t) ( cClock::Now() - myEpoch ).total_milliseconds();
+    }
+
+private:
+    boost::posix_time::ptime myEpoch;                  /// construction, on cClock
+    std::vector< std::uint32_t > myLastActivity;
+    std::vector< std::uint8_t > myState;
+    std::vector< void * > myOwner;
+    std::vector< int > myFree;
+};
@@ -0,0 +1,90 @@
+#include "cFairScheduler.h"
+
+cFairScheduler::cFairScheduler( boost::asio::io_service& io_service )
+    : myIOService( io_service )
+    , myfTurnPosted( false )
+    , myYields( 0 )
+{
+
+}
+
+bool cFairScheduler::Charge(
+    sFairShare& share,
+    std::size_t bytes )
+{
+    share.myDeficit -= bytes;
+    share.myFrames++;
+    return share.myDeficit > 0 && share.myFrames < FAIR_FRAME_BUDGET;
+}
+
+void cFairScheduler::Yield(
+    sFairShare& share,
+    std::function< void() > resume )
+{
+    sWaiting w;
+    w.myShare = &share;
+    w.myResume = resume;
+    myWaiting.push_back( w );
+    myYields++;
+
+    // the turn runs after the handlers already waiting, the other connections' reads among them
+    if( ! myfTurnPosted )
+    {
+        myfTurnPosted = true;
+        myIOService.post( [this]()
+        {
+            Turn();
+        });
+    }
+}
+
+void cFairScheduler::Rest( sFairShare& share )
+{
+    share = sFairShare();
+}
+
+void cFairScheduler::Cancel( sFairShare& share )
+{
+    for( auto it = myWaiting.begin(); it != myWaiting.end(); )
+    {
+        if( it->myShare == &share )
+            it = myWaiting.erase( it );
+        else
+            it++;
+    }
+    Rest( share );
+}
+
+void cFairScheduler::Turn()
+{
+    myfTurnPosted = false;
+    while( myWaiting.size() )
+    {
+        sWaiting w = myWaiting.front();
+        myWaiting.pop_front();
+        w.myShare->myDeficit += FAIR_QUANTUM_BYTES;
+        w.myShare->myFrames = 0;
+        if( w.myShare->myDeficit <= 0 )
+        {
+            // overspent by more than a quantum on a large frame, wait another round
+            myWaiting.push_back( w );
+            continue;
+        }
+
+        // a connection that left some of its quantum unspent keeps at most one more
+        if( w.myShare->myDeficit > 2 * FAIR_QUANTUM_BYTES )
+            w.myShare->myDeficit = 2 * FAIR_QUANTUM_BYTES;
+        w.myResume();
+        break;
+    }
+
+    // one connection per turn, so the others' handlers run between
+    if( myWaiting.size() && ! myfTurnPosted )
+    {
+        myfTurnPosted = true;
+        myIOService.post( [this]()
+        {
+            Turn();
+        });
+    }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <boost/asio.hpp>
+
+// bytes a connection may read each turn, before the deficit carried from earlier turns
+#define FAIR_QUANTUM_BYTES ( 16 * 1024 )
+
+// most frames a connection may read each turn
+#define FAIR_FRAME_BUDGET 16
+
+/// a connection's share of the event manager
+struct sFairShare
+{
+    long myDeficit;                     /// bytes the connection may still read this turn
+    int myFrames;                       /// frames read this turn
+
+    sFairShare()
+        : myDeficit( FAIR_QUANTUM_BYTES )
+        , myFrames( 0 )
+    {
+
+    }
+};
+
+/** Shares the event manager fairly between busy connections, deficit round robin
+
+    Each connection reading frames continuously charges every frame to its share.
+    Once it has read FAIR_QUANTUM_BYTES, or FAIR_FRAME_BUDGET frames, it yields:
+    its next read waits at the back of a round robin queue, and the handlers
+    of other connections run meanwhile.  When its turn comes round
+    it is given another quantum, plus whatever it overspent or left unspent before,
+    so over time each busy connection gets the same bytes, whatever its frame sizes.
+
+    A connection that has read everything waiting for it rests: its share goes back to a full quantum,
+    so a quiet connection only yields within a burst, however many frames it reads over its lifetime,
+    and its latency does not grow with the load on its neighbours.
+
+    Not thread safe, use from the event manager thread.
+*/
+class cFairScheduler
+{
+public:
+
+    cFairScheduler( boost::asio::io_service& io_service );
+
+    /** Charge a frame to a connection's share
+        @param[in] share of connection
+        @param[in] bytes of frame
+        @return true if the connection may read another frame now, false if it must Yield()
+    */
+    bool Charge(
+        sFairShare& share,
+        std::size_t bytes );
+
+    /** Give up the connection's turn
+        @param[in] share of connection
+        @param[in] resume called when its turn comes round again
+    */
+    void Yield(
+        sFairShare& share,
+        std::function< void() > resume );
+
+    /** The connection has no backlog, start its next burst with a full share
+        @param[in] share of connection
+    */
+    void Rest( sFairShare& share );
+
+    /// forget a connection that is closing, its resume is not called and its share starts afresh
+    void Cancel( sFairShare& share );
+
+    /// number of times connections have yielded
+    unsigned long long Yields() const
+    {
+        return myYields;
+    }
+
+private:
+
+    struct sWaiting
+    {
+        sFairShare * myShare;
+        std::function< void() > myResume;
+    };
+
+    boost::asio::io_service& myIOService;
+    std::deque< sWaiting > myWaiting;   /// connections that have yielded, in turn order
+    bool myfTurnPosted;
+    unsigned long long myYields;
+
+    /// give the next connection its turn
+    void Turn();
+};
@@ -0,0 +1,153 @@
+#include "cFrameMerge.h"
+
+cFrameMerge::cFrameMerge(
+    boost::asio::io_service& io_service,
+    std::uint64_t lateness_usecs,
+    int idle_msecs,
+    std::size_t buffer_frames )
+    : myTimer( io_service )
+    , myLateness( lateness_usecs )
+    , myIdle( idle_msecs )
+    , myCapacity( buffer_frames )
+    , myEmitted( 0 )
+    , myLate( 0 )
+{
+    Tick();
+}
+
+std::uint64_t cFrameMerge::Now()
+{
+    // on the clock the idle check's timer runs on, so both move together in virtual time
+    static const boost::posix_time::ptime epoch( boost::gregorian::date( 1970, 1, 1 ));
+    return ( cClock::Now() - epoch ).total_microseconds();
+}
+
+void cFrameMerge::Stop()
+{
+    myTimer.cancel();
+    while( myHeads.size() )
+        EmitOne();
+}
+
+cNonBlockingTCPClient::frame_handler_t cFrameMerge::Handler( int source )
+{
+    return [this, source](
+               int type,
+               const std::vector< boost::asio::mutable_buffer >& payload,
+               std::size_t length )
+    {
+        sFrame frame;
+        frame.mySource = source;
+        frame.myType = type;
+        frame.myTimestamp = myTimestamp ? myTimestamp( type, payload, length ) : Now();
+        frame.myPayload.resize( length );
+        boost::asio::buffer_copy( boost::asio::buffer( frame.myPayload ), payload, length );
+        Push( frame );
+    };
+}
+
+void cFrameMerge::Push( sFrame& frame )
+{
+    if( frame.myTimestamp < myEmitted )
+    {
+        myLate++;
+        return;
+    }
+
+    sSource& s = mySources[ frame.mySource ];
+    s.myLastPush = Now();
+    Activate( s, true );
+
+    // move source's head if the new frame is its oldest
+    if( ! s.myBuffer.size() || frame.myTimestamp < s.myBuffer.top().myTimestamp )
+    {
+        if( s.myBuffer.size() )
+            myHeads.erase( std::make_pair( s.myBuffer.top().myTimestamp, frame.mySource ));
+        myHeads.insert( std::make_pair( frame.myTimestamp, frame.mySource ));
+    }
+    std::uint64_t ts = frame.myTimestamp;
+    s.myBuffer.push( std::move( frame ));
+
+    if( ts > myLateness && ts - myLateness > s.myWatermark )
+        SetWatermark( s, ts - myLateness );
+
+    // a full reorder buffer forces out the oldest frames
+    while( s.myBuffer.size() > myCapacity )
+        EmitOne();
+
+    if( myWatermarks.size() )
+        EmitUpTo( *myWatermarks.begin() );
+}
+
+void cFrameMerge::Activate( sSource& s, bool f )
+{
+    if( s.myfActive == f )
+        return;
+    s.myfActive = f;
+    if( f )
+        myWatermarks.insert( s.myWatermark );
+    else
+        myWatermarks.erase( myWatermarks.find( s.myWatermark ));
+}
+
+void cFrameMerge::SetWatermark( sSource& s, std::uint64_t watermark )
+{
+    if( s.myfActive )
+    {
+        myWatermarks.erase( myWatermarks.find( s.myWatermark ));
+        myWatermarks.insert( watermark );
+    }
+    s.myWatermark = watermark;
+}
+
+void cFrameMerge::EmitUpTo( std::uint64_t limit )
+{
+    while( myHeads.size() && myHeads.begin()->first <= limit )
+        EmitOne();
+}
+
+void cFrameMerge::EmitOne()
+{
+    if( ! myHeads.size() )
+        return;
+    int source = myHeads.begin()->second;
+    myHeads.erase( myHeads.begin() );
+
+    sSource& s = mySources[ source ];
+    sFrame frame = std::move( const_cast< sFrame& >( s.myBuffer.top() ));
+    s.myBuffer.pop();
+    if( s.myBuffer.size() )
+        myHeads.insert( std::make_pair( s.myBuffer.top().myTimestamp, source ));
+
+    myEmitted = frame.myTimestamp;
+    if( myEmit )
+        myEmit( frame );
+}
+
+void cFrameMerge::Tick()
+{
+    // sources that have gone quiet stop holding back the others
+    std::uint64_t now = Now();
+    for( auto& p : mySources )
+    {
+        sSource& s = p.second;
+        if( s.myfActive && now - s.myLastPush > (std::uint64_t)myIdle * 1000 )
+            Activate( s, false );
+    }
+    if( myWatermarks.size() )
+        EmitUpTo( *myWatermarks.begin() );
+    else
+    {
+        // every source is quiet, nothing is coming to go before what is buffered
+        while( myHeads.size() )
+            EmitOne();
+    }
+
+    myTimer.expires_from_now( boost::posix_time::milliseconds( myIdle / 2 + 1 ));
+    myTimer.async_wait(
+        [this]( const boost::system::error_code& error )
+    {
+        if( ! error )
+            Tick();
+    });
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <vector>
+#include <set>
+#include <map>
+#include <queue>
+#include <functional>
+#include <cstdint>
+#include <boost/asio.hpp>
+
+#include "cClock.h"
+#include "cNonBlockingTCPClient.h"
+
+/** Merge frames from several connections into one stream in timestamp order
+
+    Each source may deliver its frames a little out of order,
+    so frames wait in a bounded per-source reorder buffer.
+
+    A source's watermark is the latest timestamp it has delivered, less the allowed lateness.
+    Every frame older than the lowest watermark of the active sources is emitted, oldest first.
+    A source that delivers nothing for the idle time stops holding the others back.
+    A source whose reorder buffer fills forces out the oldest frames.
+    A frame older than one already emitted is late and is dropped.
+
+    The oldest frame of each source, and the watermark of each source,
+    are kept in ordered sets, so merging costs O( log N ) per frame for N sources.
+
+    Use from the event manager thread.
+*/
+class cFrameMerge
+{
+public:
+
+    /// a frame waiting to be merged
+    struct sFrame
+    {
+        std::uint64_t myTimestamp;          /// usecs
+        int mySource;
+        int myType;
+        std::vector< unsigned char > myPayload;
+    };
+
+    /** Extracts timestamp from a frame
+        @return timestamp, usecs
+    */
+    typedef std::function< std::uint64_t(
+        int type,
+        const std::vector< boost::asio::mutable_buffer >& payload,
+        std::size_t length ) > timestamp_t;
+
+    /** CTOR
+        @param[in] io_service the event manager, runs the idle check
+        @param[in] lateness_usecs how far out of order a source may deliver
+        @param[in] idle_msecs time after which a silent source no longer holds back the merge
+        @param[in] buffer_frames capacity of each source's reorder buffer
+    */
+    cFrameMerge(
+        boost::asio::io_service& io_service,
+        std::uint64_t lateness_usecs,
+        int idle_msecs,
+        std::size_t buffer_frames );
+
+    /** Register timestamp extractor
+
+        The default timestamps each frame with the time it was received, usecs since 1970 on cClock
+    */
+    void Timestamp( timestamp_t extractor )
+    {
+        myTimestamp = extractor;
+    }
+
+    /// Register handler for frames emitted in timestamp order
+    void EmitHandler( std::function< void( sFrame& frame ) > handler )
+    {
+        myEmit = handler;
+    }
+
+    /** Frame handler feeding a source
+        @param[in] source id
+        @return handler to register with a connection or stream multiplexer
+    */
+    cNonBlockingTCPClient::frame_handler_t Handler( int source );
+
+    /** Add a frame to the merge
+        @param[in] frame, its source and timestamp set
+    */
+    void Push( sFrame& frame );
+
+    /// Emit every buffered frame, oldest first, and stop checking for idle sources
+    void Stop();
+
+    /// Number of frames dropped because they arrived after the merge had passed them
+    unsigned long long Late() const
+    {
+        return myLate;
+    }
+
+private:
+
+    struct sOlder
+    {
+        bool operator()( const sFrame& a, const sFrame& b ) const
+        {
+            return a.myTimestamp > b.myTimestamp;
+        }
+    };
+
+    struct sSource
+    {
+        std::priority_queue< sFrame, std::vector< sFrame >, sOlder > myBuffer;
+        std::uint64_t myWatermark;
+        std::uint64_t myLastPush;           /// receive time of last frame, usecs
+        bool myfActive;                     /// true if holding back the merge
+
+        sSource()
+            : myWatermark( 0 )
+            , myLastPush( 0 )
+            , myfActive( false )
+        {
+
+        }
+    };
+
+    event_timer_t myTimer;
+    std::uint64_t myLateness;
+    int myIdle;
+    std::size_t myCapacity;
+    std::map< int, sSource > mySources;
+    std::set< std::pair< std::uint64_t, int > > myHeads;        /// oldest buffered timestamp of each source
+    std::multiset< std::uint64_t > myWatermarks;                /// watermarks of active sources
+    std::uint64_t myEmitted;                                    /// timestamp of last emitted frame
+    unsigned long long myLate;
+    timestamp_t myTimestamp;
+    std::function< void( sFrame& frame ) > myEmit;
+
+    /// emit frames, oldest first, with timestamp up to limit
+    void EmitUpTo( std::uint64_t limit );
+
+    /// emit oldest frame of all
+    void EmitOne();
+
+    void Activate( sSource& s, bool f );
+
+    void SetWatermark( sSource& s, std::uint64_t watermark );
+
+    static std::uint64_t Now();
+
+    /// check for idle sources, then reschedule
+    void Tick();
+};
@@ -0,0 +1,288 @@
+#include <iostream>
+#include <cstring>
+#include <boost/bind.hpp>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+#include "cHandoff.h"
+
+cHandoff::cHandoff(
+    boost::asio::io_service& io_service,
+    const std::string& path )
+    : myIOService( io_service )
+    , myPath( path )
+    , myAcceptor( io_service )
+    , mySuccessor( io_service )
+    , myClient( 0 )
+{
+
+}
+
+#ifdef __linux__
+
+namespace
+{
+/// write all to socket, blocking, failing rather than raising SIGPIPE if the reader has gone
+bool WriteAll( int fd, const unsigned char * p, std::size_t length )
+{
+    while( length )
+    {
+        ssize_t n = send( fd, p, length, MSG_NOSIGNAL );
+        if( n <= 0 )
+            return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+/// read all, blocking
+bool ReadAll( int fd, unsigned char * p, std::size_t length )
+{
+    while( length )
+    {
+        ssize_t n = read( fd, p, length );
+        if( n <= 0 )
+            return false;
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+/// fail blocking reads and writes on socket that take longer than HANDOFF_TIMEOUT_SECS
+void SetTimeout( int fd )
+{
+    timeval tv;
+    tv.tv_sec = HANDOFF_TIMEOUT_SECS;
+    tv.tv_usec = 0;
+    setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof( tv ));
+    setsockopt( fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof( tv ));
+}
+}
+
+bool cHandoff::TakeOver( cNonBlockingTCPClient& client )
+{
+    int unix_fd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+    if( unix_fd < 0 )
+        return false;
+    sockaddr_un addr;
+    memset( &addr, 0, sizeof( addr ));
+    addr.sun_family = AF_UNIX;
+    strncpy( addr.sun_path, myPath.c_str(), sizeof( addr.sun_path ) - 1 );
+    if( connect( unix_fd, (sockaddr *) &addr, sizeof( addr )))
+    {
+        // no process to take over from
+        close( unix_fd );
+        return false;
+    }
+    std::cout << "Taking over connection from running process\n";
+
+    // a running process that never answers must not stop this one starting
+    SetTimeout( unix_fd );
+
+    // the socket arrives with the length of the state
+    unsigned char length_bytes[4];
+    char control[ CMSG_SPACE( sizeof( int )) ];
+    iovec iov;
+    iov.iov_base = length_bytes;
+    iov.iov_len = sizeof( length_bytes );
+    msghdr msg;
+    memset( &msg, 0, sizeof( msg ));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof( control );
+    ssize_t n = recvmsg( unix_fd, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC );
+    int fd = -1;
+    cmsghdr * cmsg = CMSG_FIRSTHDR( &msg );
+    if( cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS )
+        memcpy( &fd, CMSG_DATA( cmsg ), sizeof( fd ));
+    if( n != sizeof( length_bytes ) || fd < 0 )
+    {
+        std::cout << "Running process had no connection to hand off\n";
+        if( fd >= 0 )
+            close( fd );
+        close( unix_fd );
+        return false;
+    }
+
+    std::vector< unsigned char > state(
+        ( length_bytes[0] << 24 ) | ( length_bytes[1] << 16 )
+        | ( length_bytes[2] << 8 ) | length_bytes[3] );
+    if( ! ReadAll( unix_fd, state.data(), state.size() ))
+    {
+        // the running process keeps the connection
+        close( fd );
+        close( unix_fd );
+        return false;
+    }
+    bool ok = client.Adopt( fd, state );
+
+    // tell the running process whether it can let the connection go
+    unsigned char taken = ok ? 1 : 0;
+    WriteAll( unix_fd, &taken, 1 );
+    close( unix_fd );
+    return ok;
+}
+
+void cHandoff::Listen(
+    cNonBlockingTCPClient& client,
+    std::function< void() > done )
+{
+    myClient = &client;
+    myDone = done;
+
+    // the previous process, if any, has finished with the path
+    unlink( myPath.c_str() );
+    boost::system::error_code ec;
+    myAcceptor.open( boost::asio::local::stream_protocol(), ec );
+    if( ! ec )
+        myAcceptor.bind( boost::asio::local::stream_protocol::endpoint( myPath ), ec );
+
+    // only this user may connect, and so receive the connection.
+    // Nothing can connect before the listen, so there is no window
+    if( ! ec && chmod( myPath.c_str(), S_IRUSR | S_IWUSR ))
+        ec = boost::system::error_code( errno, boost::system::system_category() );
+    if( ! ec )
+        myAcceptor.listen( 1, ec );
+    if( ec )
+    {
+        std::cout << "Cannot listen for successor on " << myPath << "\n";
+        return;
+    }
+    std::cout << "Listening for successor on " << myPath << "\n";
+    Accept();
+}
+
+void cHandoff::Accept()
+{
+    myAcceptor.async_accept(
+        mySuccessor,
+        boost::bind(&cHandoff::handle_accept, this,
+                    boost::asio::placeholders::error ));
+}
+
+void cHandoff::handle_accept( const boost::system::error_code& error )
+{
+    if( error )
+        return;
+
+    // the socket is private to this user, but check in case its permissions were changed
+    ucred cred;
+    socklen_t len = sizeof( cred );
+    if( getsockopt( mySuccessor.native_handle(), SOL_SOCKET, SO_PEERCRED, &cred, &len )
+            || cred.uid != geteuid() )
+    {
+        std::cout << "Refused handoff to process of another user\n";
+        boost::system::error_code ec;
+        mySuccessor.close( ec );
+        Accept();
+        return;
+    }
+    std::cout << "Successor started, handing off connection\n";
+    if( ! myClient->Freeze( boost::bind( &cHandoff::Send, this )))
+    {
+        // closing the socket without sending one tells the successor to start afresh
+        std::cout << "Read in progress, keeping connection\n";
+        boost::system::error_code ec;
+        mySuccessor.close( ec );
+        Accept();
+    }
+}
+
+void cHandoff::Send()
+{
+    int fd = -1;
+    std::vector< unsigned char > state;
+    if( ! myClient->Export( fd, state ))
+    {
+        // closing the socket without sending one tells the successor to start afresh
+        std::cout << "No connection to hand off\n";
+    }
+    else
+    {
+        unsigned char length_bytes[4];
+        length_bytes[0] = ( state.size() >> 24 ) & 0xff;
+        length_bytes[1] = ( state.size() >> 16 ) & 0xff;
+        length_bytes[2] = ( state.size() >> 8 ) & 0xff;
+        length_bytes[3] = state.size() & 0xff;
+        char control[ CMSG_SPACE( sizeof( int )) ];
+        memset( control, 0, sizeof( control ));
+        iovec iov;
+        iov.iov_base = length_bytes;
+        iov.iov_len = sizeof( length_bytes );
+        msghdr msg;
+        memset( &msg, 0, sizeof( msg ));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof( control );
+        cmsghdr * cmsg = CMSG_FIRSTHDR( &msg );
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN( sizeof( int ));
+        memcpy( CMSG_DATA( cmsg ), &fd, sizeof( fd ));
+
+        // the successor is waiting, so blocking here is brief
+        int unix_fd = mySuccessor.native_handle();
+        mySuccessor.native_non_blocking( false );
+        SetTimeout( unix_fd );
+        unsigned char taken = 0;
+        if( sendmsg( unix_fd, &msg, MSG_NOSIGNAL ) != sizeof( length_bytes )
+                || ! WriteAll( unix_fd, state.data(), state.size() )
+                || ! ReadAll( unix_fd, &taken, 1 ) || ! taken )
+        {
+            // the successor has not adopted the connection, so carry on with it here.
+            // If the successor got the socket without all the state it discarded it
+            std::cout << "Handoff to successor failed, keeping connection\n";
+            boost::system::error_code ec;
+            mySuccessor.close( ec );
+            myClient->Adopt( fd, state );
+            Accept();
+            return;
+        }
+        std::cout << "Connection handed off, " << state.size() << " bytes of state\n";
+        close( fd );
+    }
+    boost::system::error_code ec;
+    mySuccessor.close( ec );
+    myAcceptor.close( ec );
+    if( myDone )
+        myDone();
+}
+
+#else
+
+bool cHandoff::TakeOver( cNonBlockingTCPClient& client )
+{
+    return false;
+}
+
+void cHandoff::Listen(
+    cNonBlockingTCPClient& client,
+    std::function< void() > done )
+{
+    std::cout << "Handoff needs linux\n";
+}
+
+void cHandoff::Accept()
+{
+
+}
+
+void cHandoff::handle_accept( const boost::system::error_code& error )
+{
+
+}
+
+void cHandoff::Send()
+{
+
+}
+
+#endif
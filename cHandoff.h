@@ -0,0 +1,76 @@
+#pragma once
+
+#include <string>
+#include <functional>
+#include <boost/asio.hpp>
+
+#include "cNonBlockingTCPClient.h"
+
+// secs a blocking handoff read or write may take before the handoff is abandoned
+#define HANDOFF_TIMEOUT_SECS 5
+
+/** Hand a connection from a running process to its successor
+
+    Upgrades the binary without dropping the connection to the server.
+
+    The running process listens on a unix domain socket.
+    When the successor connects, the client is frozen at a frame boundary,
+    its socket is passed to the successor with SCM_RIGHTS,
+    along with its session state: sequence and acknowledgement numbers
+    and the frames waiting to be written or acknowledged.
+    The successor adopts the connection, confirms it has, and carries on where the
+    running process stopped, then listens in its turn for its own successor.
+
+    The server sees neither a disconnect nor a resume.
+
+    The unix domain socket is private to the user, and the successor must run as the same user.
+    If the handoff fails the running process adopts the connection back and keeps listening.
+*/
+class cHandoff
+{
+public:
+
+    /** CTOR
+        @param[in] io_service the event manager
+        @param[in] path of unix domain socket
+    */
+    cHandoff(
+        boost::asio::io_service& io_service,
+        const std::string& path );
+
+    /** Take over connection from running process
+        @param[in] client to adopt the connection
+        @return true if a connection was taken over
+
+        Blocks until done.  Returns false at once if no process is listening.
+    */
+    bool TakeOver( cNonBlockingTCPClient& client );
+
+    /** Listen for a successor
+        @param[in] client whose connection is handed off
+        @param[in] done called when the connection has been handed off
+
+        This is non-blocking, returning immediatly.
+        A successor arriving while the client has a Read() in progress
+        is sent no connection, and this process keeps it.
+    */
+    void Listen(
+        cNonBlockingTCPClient& client,
+        std::function< void() > done );
+
+private:
+    boost::asio::io_service& myIOService;
+    std::string myPath;
+    boost::asio::local::stream_protocol::acceptor myAcceptor;
+    boost::asio::local::stream_protocol::socket mySuccessor;
+    cNonBlockingTCPClient * myClient;
+    std::function< void() > myDone;
+
+    /// wait for successor to connect
+    void Accept();
+
+    void handle_accept( const boost::system::error_code& error );
+
+    /// client frozen, send it to successor
+    void Send();
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <cstdint>
+
+/** Histogram of durations
+
+    Buckets are powers of two nanoseconds, so recording is a count leading zeros
+    and an increment, and percentiles are accurate to within a factor of two.
+*/
+class cHistogram
+{
+public:
+
+    cHistogram()
+        : myCount( 0 )
+        , myMax( 0 )
+    {
+        for( auto& b : myBuckets )
+            b = 0;
+    }
+
+    /// record a duration, nanoseconds
+    void Add( std::uint64_t nsecs )
+    {
+#ifdef __GNUC__
+        int bucket = nsecs ? 64 - __builtin_clzll( nsecs ) : 0;
+#else
+        int bucket = 0;
+        for( std::uint64_t v = nsecs; v; v >>= 1 )
+            bucket++;
+#endif
+        myBuckets[ bucket ]++;
+        myCount++;
+        if( nsecs > myMax )
+            myMax = nsecs;
+    }
+
+    std::uint64_t Count() const
+    {
+        return myCount;
+    }
+
+    /** Percentile
+        @param[in] p percent, 0 to 100
+        @return upper bound of bucket holding the percentile, or the maximum if lower, nanoseconds
+    */
+    std::uint64_t Percentile( double p ) const
+    {
+        std::uint64_t target = myCount * p / 100;
+        std::uint64_t seen = 0;
+        for( int b = 0; b < 65; b++ )
+        {
+            seen += myBuckets[b];
+            if( seen > target )
+            {
+                std::uint64_t bound = b ? ( b < 64 ? ( 1ULL << b ) - 1 : myMax ) : 0;
+                return bound < myMax ? bound : myMax;
+            }
+        }
+        return myMax;
+    }
+
+    /// print count and percentiles in microseconds
+    void Print( const std::string& name ) const
+    {
+        std::cout << name << ": ";
+        if( ! myCount )
+        {
+            std::cout << "none\n";
+            return;
+        }
+        std::cout << myCount
+                  << " p50 < " << Percentile( 50 ) / 1000.0
+                  << " p90 < " << Percentile( 90 ) / 1000.0
+                  << " p99 < " << Percentile( 99 ) / 1000.0
+                  << " max " << myMax / 1000.0 << " usecs\n";
+    }
+
+private:
+    std::uint64_t myBuckets[65];        /// bucket b holds durations with b significant bits
+    std::uint64_t myCount;
+    std::uint64_t myMax;
+};
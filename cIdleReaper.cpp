@@ -0,0 +1,70 @@
+#include <iostream>
+#include <boost/bind.hpp>
+
+#include "cIdleReaper.h"
+#include "cNonBlockingTCPClient.h"
+
+cIdleReaper::cIdleReaper(
+    boost::asio::io_service& io_service,
+    cConnectionTable& table,
+    unsigned int idle_msecs,
+    unsigned int ttl_msecs )
+    : myTimer( io_service )
+    , myTable( table )
+    , myIdleMsecs( idle_msecs )
+    , myTTLMsecs( ttl_msecs )
+    , myIdled( 0 )
+    , myReaped( 0 )
+{
+    myTimer.expires_from_now( boost::posix_time::milliseconds( IDLE_SWEEP_MSECS ));
+    myTimer.async_wait( boost::bind( &cIdleReaper::handle_sweep, this,
+                                     boost::asio::placeholders::error ));
+}
+
+void cIdleReaper::Stop()
+{
+    boost::system::error_code ec;
+    myTimer.cancel( ec );
+}
+
+void cIdleReaper::handle_sweep( const boost::system::error_code& error )
+{
+    if( error )
+        return;
+
+    myTable.Sweep(
+        myIdleMsecs,
+        [this]( int slot )
+    {
+        cNonBlockingTCPClient * client = (cNonBlockingTCPClient *) myTable.Owner( slot );
+        if( ! client->IsConnected() )
+            return;
+        if( ! client->IsIdle() )
+        {
+            client->Idle();
+            myIdled++;
+        }
+    });
+    if( myTTLMsecs )
+    {
+        unsigned long long before = myReaped;
+        myTable.Sweep(
+            myTTLMsecs,
+            [this]( int slot )
+        {
+            cNonBlockingTCPClient * client = (cNonBlockingTCPClient *) myTable.Owner( slot );
+            if( client->IsConnected() )
+            {
+                client->Close();
+                myReaped++;
+            }
+        });
+        if( myReaped > before )
+            std::cout << "Closed " << myReaped - before
+                      << " connections idle for " << myTTLMsecs << " msecs\n";
+    }
+
+    myTimer.expires_from_now( boost::posix_time::milliseconds( IDLE_SWEEP_MSECS ));
+    myTimer.async_wait( boost::bind( &cIdleReaper::handle_sweep, this,
+                                     boost::asio::placeholders::error ));
+}
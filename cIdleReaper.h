@@ -0,0 +1,63 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+#include "cClock.h"
+#include "cConnectionTable.h"
+
+/// msecs between sweeps of the connection table for idle connections
+#define IDLE_SWEEP_MSECS 1000
+
+/** Releases the buffers of quiet connections, and optionally closes connections quiet too long
+
+    Sweeps the connection table, which every connection touches on each read and write,
+    so finding the quiet connections reads only the activity times.
+    A connection quiet for the idle time releases its buffers, see cNonBlockingTCPClient::Idle(),
+    so memory tracks the active connections rather than all of them.
+    A connection quiet for the time to live is closed.
+
+    The owners in the table must be cNonBlockingTCPClient.
+*/
+class cIdleReaper
+{
+public:
+
+    /** CTOR
+        @param[in] io_service the event manager
+        @param[in] table of connections
+        @param[in] idle_msecs quiet time after which buffers are released
+        @param[in] ttl_msecs quiet time after which the connection is closed, 0 for never
+
+        Starts sweeping immediately
+    */
+    cIdleReaper(
+        boost::asio::io_service& io_service,
+        cConnectionTable& table,
+        unsigned int idle_msecs,
+        unsigned int ttl_msecs = 0 );
+
+    /// stop sweeping
+    void Stop();
+
+    /// connections whose buffers have been released
+    unsigned long long Idled() const
+    {
+        return myIdled;
+    }
+
+    /// connections closed
+    unsigned long long Reaped() const
+    {
+        return myReaped;
+    }
+
+private:
+    event_timer_t myTimer;
+    cConnectionTable& myTable;
+    unsigned int myIdleMsecs;
+    unsigned int myTTLMsecs;
+    unsigned long long myIdled;
+    unsigned long long myReaped;
+
+    void handle_sweep( const boost::system::error_code& error );
+};
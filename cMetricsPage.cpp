@@ -0,0 +1,140 @@
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "cMetricsPage.h"
+
+// the values are copied to and from the page as an array
+static_assert( sizeof( sMetrics ) % sizeof( std::uint64_t ) == 0, "sMetrics must hold only 64 bit values" );
+
+cMetricsPage::cMetricsPage(
+    const std::string& path,
+    bool writer )
+    : myPage( 0 )
+    , myPath( path )
+    , myfWriter( writer )
+    , myDevice( 0 )
+    , myInode( 0 )
+{
+#ifdef __linux__
+    // the writer builds the page under a temporary name and renames it into place,
+    // so a reader still mapping an earlier page keeps it whole instead of having it truncated under it
+    std::string open_path = writer ? path + "." + std::to_string( getpid() ) : path;
+    if( writer )
+    {
+        // left by an earlier process of the same pid that died part way through
+        unlink( open_path.c_str() );
+    }
+    int fd = writer
+             ? open( open_path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644 )
+             : open( open_path.c_str(), O_RDONLY | O_CLOEXEC );
+    if( fd < 0 )
+    {
+        std::cout << "Cannot open metrics page " << open_path << "\n";
+        return;
+    }
+    struct stat st;
+    if( writer && ( ftruncate( fd, sizeof( sMetricsPage )) || fstat( fd, &st )))
+    {
+        close( fd );
+        unlink( open_path.c_str() );
+        return;
+    }
+    void * p = mmap(
+                   0, sizeof( sMetricsPage ),
+                   writer ? PROT_READ | PROT_WRITE : PROT_READ,
+                   MAP_SHARED, fd, 0 );
+    close( fd );
+    if( p == MAP_FAILED )
+    {
+        std::cout << "Cannot map metrics page " << path << "\n";
+        if( writer )
+            unlink( open_path.c_str() );
+        return;
+    }
+    myPage = (sMetricsPage *) p;
+    if( writer )
+    {
+        myDevice = st.st_dev;
+        myInode = st.st_ino;
+
+        // the file is new and zeroed, the magic number goes in last so readers see a complete header
+        myPage->myVersion = METRICS_PAGE_VERSION;
+        myPage->myPid = getpid();
+        myPage->myMagic.store( METRICS_PAGE_MAGIC, std::memory_order_release );
+        if( rename( open_path.c_str(), path.c_str() ))
+        {
+            std::cout << "Cannot publish metrics page " << path << "\n";
+            munmap( myPage, sizeof( sMetricsPage ));
+            myPage = 0;
+            unlink( open_path.c_str() );
+            return;
+        }
+    }
+#else
+    // the page stays unmapped, so Publish() does nothing and Read() fails
+    std::cout << "Metrics page needs linux\n";
+#endif
+}
+
+cMetricsPage::~cMetricsPage()
+{
+#ifdef __linux__
+    if( ! myPage )
+        return;
+    munmap( myPage, sizeof( sMetricsPage ));
+
+    // a later writer may have replaced the page, leave its page alone
+    struct stat st;
+    if( myfWriter && ! stat( myPath.c_str(), &st )
+            && st.st_dev == myDevice && st.st_ino == myInode )
+        unlink( myPath.c_str() );
+#endif
+}
+
+void cMetricsPage::Publish( const sMetrics& metrics )
+{
+    if( ! myPage || ! myfWriter )
+        return;
+    const std::uint64_t * values = (const std::uint64_t *) &metrics;
+    std::uint32_t seq = myPage->mySequence.load( std::memory_order_relaxed );
+    myPage->mySequence.store( seq + 1, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_release );
+    for( std::size_t k = 0; k < sizeof( metrics ) / sizeof( std::uint64_t ); k++ )
+        myPage->myValues[k].store( values[k], std::memory_order_relaxed );
+    myPage->mySequence.store( seq + 2, std::memory_order_release );
+}
+
+bool cMetricsPage::Read( sMetrics& metrics ) const
+{
+    if( ! myPage
+            || myPage->myMagic.load( std::memory_order_acquire ) != METRICS_PAGE_MAGIC
+            || myPage->myVersion != METRICS_PAGE_VERSION )
+        return false;
+    std::uint64_t * values = (std::uint64_t *) &metrics;
+
+    // bounded, in case the writer died part way through an update
+    for( int tries = 0; tries < 1000000; tries++ )
+    {
+        std::uint32_t before = myPage->mySequence.load( std::memory_order_acquire );
+        if( before & 1 )
+            continue;
+        for( std::size_t k = 0; k < sizeof( metrics ) / sizeof( std::uint64_t ); k++ )
+            values[k] = myPage->myValues[k].load( std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_acquire );
+        if( myPage->mySequence.load( std::memory_order_relaxed ) == before )
+            return true;
+    }
+    return false;
+}
+
+int cMetricsPage::Writer() const
+{
+    return myPage ? myPage->myPid : 0;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+// identifies a metrics page
+#define METRICS_PAGE_MAGIC 0x464c4d50
+
+// layout of the page, bumped whenever sMetricsPage changes
+#define METRICS_PAGE_VERSION 1
+
+/// a copy of the metrics
+struct sMetrics
+{
+    std::uint64_t myUpdateUsecs;        /// wall clock time of update, microseconds since epoch
+    std::uint64_t myBytesRead;
+    std::uint64_t myBytesWritten;
+    std::uint64_t myFramesRead;
+    std::uint64_t myFramesWritten;
+    std::uint64_t myConnected;          /// 1 if connected
+    std::uint64_t myWriteQueue;         /// frames waiting to be written
+    std::uint64_t myUnacknowledged;     /// frames waiting for acknowledgement
+    std::uint64_t myOutstanding;        /// requests waiting for response
+    std::uint64_t myCacheHits;
+    std::uint64_t myCacheMisses;
+};
+
+/** Metrics in a shared memory file, readable by other processes without disturbing this one
+
+    The writer updates the page in place.  Readers map the file read-only
+    and take a consistent copy under a sequence lock: the writer makes the sequence number odd,
+    updates, then makes it even again, and a reader retries if the number was odd
+    or changed while it copied.  Readers never write, so they cost the writer nothing,
+    not even a cache line bouncing between cores.
+
+    The page starts with a magic number and a layout version, so a reader built
+    against another layout refuses the page rather than misreading it.
+*/
+class cMetricsPage
+{
+public:
+
+    /** CTOR
+        @param[in] path of shared memory file, e.g. under /dev/shm
+        @param[in] writer true to create the file, replacing any earlier one, and publish to it, false to read it
+    */
+    cMetricsPage(
+        const std::string& path,
+        bool writer );
+
+    ~cMetricsPage();
+
+    /// true if the page is mapped
+    bool IsOpen() const
+    {
+        return myPage != 0;
+    }
+
+    /// Publish metrics, writer only
+    void Publish( const sMetrics& metrics );
+
+    /** Copy metrics
+        @param[out] metrics
+        @return true if successful, false if the page is not a metrics page of this layout
+                or an update never completed
+    */
+    bool Read( sMetrics& metrics ) const;
+
+    /// process id of writer
+    int Writer() const;
+
+private:
+
+    /// the shared page
+    struct sMetricsPage
+    {
+        std::atomic< std::uint32_t > myMagic;       /// set last, once the rest of the header is written
+        std::uint32_t myVersion;
+        std::int32_t myPid;
+        std::atomic< std::uint32_t > mySequence;    /// odd while an update is in progress
+        std::atomic< std::uint64_t > myValues[ sizeof( sMetrics ) / sizeof( std::uint64_t ) ];
+    };
+
+    sMetricsPage * myPage;
+    std::string myPath;
+    bool myfWriter;
+    std::uint64_t myDevice;             /// device and inode of the writer's file, to know it is still ours
+    std::uint64_t myInode;
+};
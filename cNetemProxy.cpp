@@ -0,0 +1,344 @@
+#include <iostream>
+#include <boost/bind.hpp>
+
+#include "cNetemProxy.h"
+
+cNetemProxy::sLink::sLink( boost::asio::io_service& io_service )
+    : myQueued( 0 )
+    , myLinkFree( boost::posix_time::min_date_time )
+    , myLastDue( boost::posix_time::min_date_time )
+    , myTimer( io_service )
+    , myfWriting( false )
+    , myfReadStopped( false )
+    , myFrames( 0 )
+    , myReordered( 0 )
+{
+
+}
+
+cNetemProxy::sPair::sPair( boost::asio::io_service& io_service )
+    : myDown( io_service )
+    , myUp( io_service )
+    , myLink{ sLink( io_service ), sLink( io_service ) }
+    , myReset( io_service )
+    , myfClosed( false )
+{
+    myLink[0].myFrom = &myDown;
+    myLink[0].myTo = &myUp;
+    myLink[0].myName = "client to server";
+    myLink[1].myFrom = &myUp;
+    myLink[1].myTo = &myDown;
+    myLink[1].myName = "server to client";
+}
+
+cNetemProxy::cNetemProxy(
+    boost::asio::io_service& io_service,
+    int listen_port,
+    const std::string& host,
+    const std::string& port,
+    const sNetemConditions& conditions )
+    : myIOService( io_service )
+    , myAcceptor(
+          io_service,
+          boost::asio::ip::tcp::endpoint( boost::asio::ip::tcp::v4(), listen_port ))
+    , myHost( host )
+    , myPort( port )
+    , myConditions( conditions )
+    , myRandom( conditions.mySeed )
+    , myResolver( io_service )
+    , myRetryTimer( io_service )
+{
+    std::cout << "Netem proxy listening on " << listen_port
+              << " relaying to " << host << ":" << port
+              << " latency " << conditions.myLatencyMsecs
+              << " +/- " << conditions.myJitterMsecs << " msecs"
+              << " bandwidth " << conditions.myBandwidthKbps << " kbit/s"
+              << " reorder " << conditions.myReorderPercent << "%"
+              << " reset every " << conditions.myResetSecs << " secs\n";
+    Accept();
+}
+
+void cNetemProxy::Accept()
+{
+    myPending.reset( new sPair( myIOService ));
+    myAcceptor.async_accept(
+        myPending->myDown,
+        boost::bind(&cNetemProxy::handle_accept, this,
+                    boost::asio::placeholders::error ));
+}
+
+void cNetemProxy::handle_accept( const boost::system::error_code& error )
+{
+    if( error == boost::asio::error::operation_aborted )
+        return;
+    if( error )
+    {
+        // the pending connection stays queued, so wait rather than fail again at once
+        std::cout << "Netem proxy accept failed: " << error.message() << "\n";
+        myRetryTimer.expires_from_now( boost::posix_time::milliseconds( NETEM_ACCEPT_RETRY_MSECS ));
+        myRetryTimer.async_wait( [this]( const boost::system::error_code& error )
+        {
+            if( ! error )
+                Accept();
+        });
+        return;
+    }
+    std::shared_ptr< sPair > pair = myPending;
+    Accept();
+
+    // connect upstream without blocking, so the other links' timers keep their time
+    boost::asio::ip::tcp::resolver::query query( myHost, myPort );
+    myResolver.async_resolve(
+        query,
+        [this, pair]( const boost::system::error_code& error,
+                      boost::asio::ip::tcp::resolver::iterator it )
+    {
+        if( error )
+        {
+            handle_connect( pair, error );
+            return;
+        }
+        boost::asio::async_connect(
+            pair->myUp,
+            it,
+            [this, pair]( const boost::system::error_code& error,
+                          boost::asio::ip::tcp::resolver::iterator )
+        {
+            handle_connect( pair, error );
+        });
+    });
+}
+
+void cNetemProxy::handle_connect(
+    std::shared_ptr< sPair > pair,
+    const boost::system::error_code& error )
+{
+    if( error )
+    {
+        std::cout << "Netem proxy upstream connection failed\n";
+        return;
+    }
+    std::cout << "Netem proxy relaying new connection\n";
+
+    // the proxy's own sockets add no delay of their own
+    pair->myDown.set_option( boost::asio::ip::tcp::no_delay( true ));
+    pair->myUp.set_option( boost::asio::ip::tcp::no_delay( true ));
+
+    if( myConditions.myResetSecs )
+    {
+        std::exponential_distribution< double > lifetime( 1.0 / myConditions.myResetSecs );
+        pair->myReset.expires_from_now(
+            boost::posix_time::milliseconds( (long)( lifetime( myRandom ) * 1000 )));
+        pair->myReset.async_wait( [this, pair]( const boost::system::error_code& error )
+        {
+            if( error )
+                return;
+            std::cout << "Netem proxy resetting connection\n";
+            Close( *pair, true );
+        });
+    }
+
+    ReadFrame( pair, 0 );
+    ReadFrame( pair, 1 );
+}
+
+void cNetemProxy::ReadFrame(
+    std::shared_ptr< sPair > pair,
+    int dir )
+{
+    sLink& link = pair->myLink[ dir ];
+    boost::asio::async_read(
+        *link.myFrom,
+        boost::asio::buffer( link.myHeader.myBytes, FRAME_HEADER_BYTES ),
+        boost::bind(&cNetemProxy::handle_header, this, pair, dir,
+                    boost::asio::placeholders::error ));
+}
+
+void cNetemProxy::handle_header(
+    std::shared_ptr< sPair > pair,
+    int dir,
+    const boost::system::error_code& error )
+{
+    if( pair->myfClosed )
+        return;
+    if( error )
+    {
+        Close( *pair, false );
+        return;
+    }
+    sLink& link = pair->myLink[ dir ];
+    if( ! link.myHeader.IsValid()
+            || link.myHeader.Length() > NETEM_MAX_PAYLOAD_BYTES )
+    {
+        std::cout << "Netem proxy " << link.myName << " is not a frame stream\n";
+        Close( *pair, false );
+        return;
+    }
+
+    netem_frame_t frame( new std::vector< unsigned char >(
+                             FRAME_HEADER_BYTES + link.myHeader.Length() ));
+    memcpy( frame->data(), link.myHeader.myBytes, FRAME_HEADER_BYTES );
+    boost::asio::async_read(
+        *link.myFrom,
+        boost::asio::buffer( frame->data() + FRAME_HEADER_BYTES, link.myHeader.Length() ),
+        boost::bind(&cNetemProxy::handle_payload, this, pair, dir, frame,
+                    boost::asio::placeholders::error ));
+}
+
+void cNetemProxy::handle_payload(
+    std::shared_ptr< sPair > pair,
+    int dir,
+    netem_frame_t frame,
+    const boost::system::error_code& error )
+{
+    if( pair->myfClosed )
+        return;
+    if( error )
+    {
+        Close( *pair, false );
+        return;
+    }
+    sLink& link = pair->myLink[ dir ];
+    Enqueue( link, frame );
+    Deliver( pair, dir );
+
+    // a full link stops reading, and so pushes back on the sender
+    if( link.myQueued > NETEM_QUEUE_BYTES )
+        link.myfReadStopped = true;
+    else
+        ReadFrame( pair, dir );
+}
+
+void cNetemProxy::Enqueue(
+    sLink& link,
+    netem_frame_t frame )
+{
+    boost::posix_time::ptime now = cClock::Now();
+
+    // time on the wire at the link's bandwidth, behind the frames already sent
+    boost::posix_time::ptime sent = now;
+    if( myConditions.myBandwidthKbps )
+    {
+        if( link.myLinkFree > sent )
+            sent = link.myLinkFree;
+        sent += boost::posix_time::microseconds(
+                    (long long) frame->size() * 8 * 1000 / myConditions.myBandwidthKbps );
+        link.myLinkFree = sent;
+    }
+
+    boost::posix_time::ptime due = sent + boost::posix_time::milliseconds(
+                                       Delay( myConditions.myLatencyMsecs, myConditions.myJitterMsecs ));
+
+    std::uniform_int_distribution< int > percent( 0, 99 );
+    if( myConditions.myReorderPercent
+            && percent( myRandom ) < myConditions.myReorderPercent )
+    {
+        // held back, so the frames behind overtake it
+        due += boost::posix_time::milliseconds(
+                   Delay( myConditions.myLatencyMsecs, myConditions.myJitterMsecs ) + 1 );
+        link.myReordered++;
+    }
+    else
+    {
+        // jitter alone does not reorder
+        if( due < link.myLastDue )
+            due = link.myLastDue;
+        link.myLastDue = due;
+    }
+
+    link.myQueue.insert( std::make_pair( due, frame ));
+    link.myQueued += frame->size();
+    link.myFrames++;
+}
+
+void cNetemProxy::Deliver(
+    std::shared_ptr< sPair > pair,
+    int dir )
+{
+    sLink& link = pair->myLink[ dir ];
+    if( pair->myfClosed || link.myfWriting || ! link.myQueue.size() )
+        return;
+
+    auto first = link.myQueue.begin();
+    if( cClock::Now() < first->first )
+    {
+        // wait for it, the timer is moved if an earlier frame arrives
+        link.myTimer.expires_at( first->first );
+        link.myTimer.async_wait( [this, pair, dir]( const boost::system::error_code& error )
+        {
+            if( ! error )
+                Deliver( pair, dir );
+        });
+        return;
+    }
+
+    netem_frame_t frame = first->second;
+    link.myQueue.erase( first );
+    link.myfWriting = true;
+    boost::asio::async_write(
+        *link.myTo,
+        boost::asio::buffer( *frame ),
+        boost::bind(&cNetemProxy::handle_delivered, this, pair, dir, frame->size(),
+                    boost::asio::placeholders::error ));
+}
+
+void cNetemProxy::handle_delivered(
+    std::shared_ptr< sPair > pair,
+    int dir,
+    std::size_t bytes,
+    const boost::system::error_code& error )
+{
+    sLink& link = pair->myLink[ dir ];
+    link.myfWriting = false;
+    link.myQueued -= bytes;
+    if( pair->myfClosed )
+        return;
+    if( error )
+    {
+        Close( *pair, false );
+        return;
+    }
+    if( link.myfReadStopped && link.myQueued <= NETEM_QUEUE_BYTES / 2 )
+    {
+        link.myfReadStopped = false;
+        ReadFrame( pair, dir );
+    }
+    Deliver( pair, dir );
+}
+
+int cNetemProxy::Delay(
+    int mean,
+    int spread )
+{
+    if( ! spread )
+        return mean;
+    std::uniform_int_distribution< int > delay( mean - spread, mean + spread );
+    int d = delay( myRandom );
+    return d < 0 ? 0 : d;
+}
+
+void cNetemProxy::Close(
+    sPair& pair,
+    bool reset )
+{
+    if( pair.myfClosed )
+        return;
+    pair.myfClosed = true;
+    std::cout << "Netem proxy connection closed, relayed "
+              << pair.myLink[0].myFrames << " frames " << pair.myLink[0].myName
+              << " ( " << pair.myLink[0].myReordered << " reordered ), "
+              << pair.myLink[1].myFrames << " frames " << pair.myLink[1].myName
+              << " ( " << pair.myLink[1].myReordered << " reordered )\n";
+    boost::system::error_code ec;
+    if( reset )
+    {
+        // zero linger makes close send RST
+        pair.myDown.set_option( boost::asio::socket_base::linger( true, 0 ), ec );
+        pair.myUp.set_option( boost::asio::socket_base::linger( true, 0 ), ec );
+    }
+    pair.myReset.cancel( ec );
+    pair.myLink[0].myTimer.cancel( ec );
+    pair.myLink[1].myTimer.cancel( ec );
+    pair.myDown.close( ec );
+    pair.myUp.close( ec );
+}
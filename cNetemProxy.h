@@ -0,0 +1,182 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <memory>
+#include <random>
+#include <string>
+#include <boost/asio.hpp>
+
+#include "cClock.h"
+#include "frame.h"
+
+/// largest frame payload relayed, a larger length is taken as a corrupt stream
+#define NETEM_MAX_PAYLOAD_BYTES ( 16 * 1024 * 1024 )
+
+/// bytes held in one direction before reading stops, the emulated link's buffer
+#define NETEM_QUEUE_BYTES ( 4 * 1024 * 1024 )
+
+/// msecs to wait before accepting again after accept fails, e.g. out of file descriptors
+#define NETEM_ACCEPT_RETRY_MSECS 100
+
+/// conditions emulated, zero for none
+struct sNetemConditions
+{
+    int myLatencyMsecs;             /// one way delay added to every frame
+    int myJitterMsecs;              /// delay varies uniformly by up to this much either way
+    int myBandwidthKbps;            /// link rate, kilobits per second
+    int myReorderPercent;           /// chance a frame is held back and overtaken by the next
+    int myResetSecs;                /// mean connection lifetime before it is reset
+    unsigned mySeed;                /// random seed, so a run can be repeated
+
+    sNetemConditions()
+        : myLatencyMsecs( 0 )
+        , myJitterMsecs( 0 )
+        , myBandwidthKbps( 0 )
+        , myReorderPercent( 0 )
+        , myResetSecs( 0 )
+        , mySeed( 1 )
+    {
+
+    }
+};
+
+/** Proxy that relays frames through emulated network conditions
+
+    Sits between the client and a test server on the same host,
+    so batching, timeouts and reconnection can be measured under WAN-like conditions
+    with no special network setup.
+
+    Each direction of each connection is a link.  A frame read from one end is delivered to the other
+
+        - after the time to send it at the link's bandwidth, behind the frames already sent
+        - plus the latency, varied by the jitter
+        - in order, unless chosen for reordering, when it is held back by a further latency
+          so that the frames behind it overtake
+
+    Jitter does not reorder frames by itself, as with a real TCP connection.
+    When a link holds more than NETEM_QUEUE_BYTES, reading stops until it drains,
+    so a slow link pushes back on the sender as TCP would.
+
+    Connections are reset, with a TCP RST to both ends, after a random lifetime
+    with the mean given.
+
+    Frames are relayed whole, so the traffic must be unencrypted 0x02 0xFD frames.
+*/
+class cNetemProxy
+{
+public:
+
+    /** CTOR
+        @param[in] io_service the event manager
+        @param[in] listen_port port to accept connections on
+        @param[in] host upstream server
+        @param[in] port upstream server port
+        @param[in] conditions to emulate
+
+        Starts accepting immediately
+    */
+    cNetemProxy(
+        boost::asio::io_service& io_service,
+        int listen_port,
+        const std::string& host,
+        const std::string& port,
+        const sNetemConditions& conditions );
+
+private:
+
+    typedef std::shared_ptr< std::vector< unsigned char > > netem_frame_t;
+
+    /// one direction of a relayed connection
+    struct sLink
+    {
+        boost::asio::ip::tcp::socket * myFrom;
+        boost::asio::ip::tcp::socket * myTo;
+        cFrameHeader myHeader;                              /// header being read
+        std::multimap< boost::posix_time::ptime, netem_frame_t > myQueue;  /// frames by delivery time
+        std::size_t myQueued;                               /// bytes in queue
+        boost::posix_time::ptime myLinkFree;                /// when the last frame finished sending
+        boost::posix_time::ptime myLastDue;                 /// delivery of last frame kept in order
+        event_timer_t myTimer;                              /// wakes when the first frame is due
+        bool myfWriting;
+        bool myfReadStopped;                                /// reading stopped while the queue drains
+        unsigned long long myFrames;
+        unsigned long long myReordered;
+        const char * myName;
+
+        sLink( boost::asio::io_service& io_service );
+    };
+
+    /// a relayed connection
+    struct sPair
+    {
+        boost::asio::ip::tcp::socket myDown;
+        boost::asio::ip::tcp::socket myUp;
+        sLink myLink[2];
+        event_timer_t myReset;
+        bool myfClosed;
+
+        sPair( boost::asio::io_service& io_service );
+    };
+
+    boost::asio::io_service& myIOService;
+    boost::asio::ip::tcp::acceptor myAcceptor;
+    std::string myHost;
+    std::string myPort;
+    sNetemConditions myConditions;
+    std::mt19937 myRandom;
+    std::shared_ptr< sPair > myPending;     /// pair waiting for a connection to accept
+    boost::asio::ip::tcp::resolver myResolver;
+    event_timer_t myRetryTimer;             /// delays accepting again after a failure
+
+    void Accept();
+
+    void handle_accept( const boost::system::error_code& error );
+
+    /// upstream connection made, start relaying
+    void handle_connect(
+        std::shared_ptr< sPair > pair,
+        const boost::system::error_code& error );
+
+    /// read the next frame header from the link's source
+    void ReadFrame(
+        std::shared_ptr< sPair > pair,
+        int dir );
+
+    void handle_header(
+        std::shared_ptr< sPair > pair,
+        int dir,
+        const boost::system::error_code& error );
+
+    void handle_payload(
+        std::shared_ptr< sPair > pair,
+        int dir,
+        netem_frame_t frame,
+        const boost::system::error_code& error );
+
+    /// schedule a frame's delivery
+    void Enqueue(
+        sLink& link,
+        netem_frame_t frame );
+
+    /// deliver the frames that are due, then wait for the next
+    void Deliver(
+        std::shared_ptr< sPair > pair,
+        int dir );
+
+    void handle_delivered(
+        std::shared_ptr< sPair > pair,
+        int dir,
+        std::size_t bytes,
+        const boost::system::error_code& error );
+
+    /// random delay, milliseconds, uniform in [ mean - spread, mean + spread ] and not negative
+    int Delay(
+        int mean,
+        int spread );
+
+    /// close both ends, with a TCP RST if reset
+    void Close(
+        sPair& pair,
+        bool reset );
+};
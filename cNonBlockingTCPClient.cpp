@@ -0,0 +1,1090 @@
+#include <cerrno>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/socket.h>
+#endif
+
+#include "cNonBlockingTCPClient.h"
+#include "cNuma.h"
+#include "cObjectCache.h"
+#include "cPerfCounters.h"
+
+const unsigned char cNonBlockingTCPClient::myConnectMessage[15] {0x02, 0xfd, 00, 0x05, 00, 00, 00, 07, 0x0f, 0x0d, 0x00, 0x00, 0x00, 0x00, 0x00};
+const unsigned char cNonBlockingTCPClient::myWriteMessage[15] {0x02, 0xfd, 0x80, 0x01, 00, 00, 00, 07, 0x0f, 0x0d, 0xAA, 0xBB, 0x22, 0x11, 0x22};
+
+sTLSLink::~sTLSLink()
+{
+    cObjectCache< boost::asio::ip::tcp::tcp::socket >::Free( mySocket );
+}
+
+std::size_t cNonBlockingTCPClient::Footprint() const
+{
+    std::size_t bytes = sizeof( *this );
+    if( myfOwnPool )
+        bytes += ( FRAME_SLOT_COUNT + 1 ) * mySlotPool->SlotBytes();  // frame slots and receive buffer
+    else
+    {
+        // slots borrowed from the shared pool
+        if( myRcvBuffer )
+            bytes += mySlotPool->SlotBytes();
+        if( mySlot )
+            bytes += mySlotPool->SlotBytes();
+    }
+    bytes += myFramePayload.capacity() * sizeof( boost::asio::mutable_buffer );
+    bytes += myResponsePayload.capacity();
+    if( mySocketTCP )
+        bytes += sizeof( *mySocketTCP );
+    if( myTable )
+        bytes += cConnectionTable::BytesPerSlot();
+    return bytes;
+}
+
+void cNonBlockingTCPClient::Connect(
+    const std::string& ip,
+    const std::string& port,
+    bool tls,
+    const std::string& cafile )
+{
+    try
+    {
+        boost::system::error_code ec;
+        boost::asio::ip::tcp::tcp::resolver resolver( myIOService );
+        boost::asio::ip::tcp::tcp::resolver::query query(
+            ip,
+            port );
+        boost::asio::ip::tcp::tcp::resolver::iterator endpoint_iterator = resolver.resolve(query,ec);
+        if( ec )
+            throw std::runtime_error("resolve");
+        // socket storage comes from the per-thread cache, so reconnect churn avoids the allocator
+        Close();
+        mySocketTCP = cObjectCache< boost::asio::ip::tcp::tcp::socket >::Allocate( myIOService );
+        if( mySource && ! mySource->Empty() )
+            ConnectFrom( *endpoint_iterator, ec );
+        else
+            boost::asio::connect( *mySocketTCP, endpoint_iterator, ec );
+        if ( ec || ( ! mySocketTCP->is_open() ) )
+        {
+            // connection failed
+            Close();
+            std::cout << "Client Connection failed\n";
+
+        }
+        else if( tls && ! Handshake( ip, port, cafile ) )
+        {
+            Close();
+            std::cout << "Client TLS handshake failed\n";
+        }
+        else
+        {
+            myConnection = constatus::yes;
+            std::cout << "Client Connected OK\n";
+
+            // a different server means a new session
+            std::string server = ip + ":" + port;
+            if( server != myServer )
+            {
+                myServer = server;
+                myUnacked.clear();
+                myAckedSeq = 0;
+            }
+
+            // hold queued frames until the connection message has gone
+            myfWriting = true;
+
+            // timestamps count bytes from here, so start before the connection message
+            if( myTimestamper )
+            {
+                if( tls )
+                    std::cout << "Timestamping not available over TLS\n";
+                else
+                    myTimestamper->Enable( mySocketTCP->native_handle() );
+            }
+
+            int node = cNuma::SocketNode( mySocketTCP->native_handle() );
+            if( node >= 0 && myNode >= 0 && node != myNode )
+                std::cout << "Warning: connection NIC is on NUMA node " << node
+                          << " but buffers are on node " << myNode << "\n";
+
+            AsyncWrite(
+                boost::asio::buffer(myConnectMessage, 15),
+                boost::bind(&cNonBlockingTCPClient::handle_connect_write, this,
+                            boost::asio::placeholders::error,
+                            boost::asio::placeholders::bytes_transferred ));
+
+            // frames sent from here wait for the connection message
+            if( myConnected )
+                myConnected();
+        }
+    }
+
+    catch ( ... )
+    {
+        std::cout << "Client Connection failed 2\n";
+    }
+}
+void cNonBlockingTCPClient::ConnectFrom(
+    const boost::asio::ip::tcp::endpoint& server,
+    boost::system::error_code& ec )
+{
+    for( int attempt = 0; attempt < SOURCE_BIND_ATTEMPTS; attempt++ )
+    {
+        boost::system::error_code ignored;
+        mySocketTCP->close( ignored );
+        mySocketTCP->open( server.protocol(), ec );
+        if( ec )
+            return;
+        int error = mySource->Bind( mySocketTCP->native_handle(), server );
+        if( error == EADDRINUSE )
+        {
+            // the source port is taken, try the next
+            ec = boost::asio::error::address_in_use;
+            continue;
+        }
+        if( error )
+        {
+            // another port will not help
+            ec = boost::system::error_code( error, boost::system::system_category() );
+            return;
+        }
+        mySocketTCP->connect( server, ec );
+        if( ! ec || ! mySource->Failed( ec.value() ))
+            return;
+    }
+}
+
+bool cNonBlockingTCPClient::Handshake(
+    const std::string& ip,
+    const std::string& port,
+    const std::string& cafile )
+{
+    if( ! myTLS || myTLS->CAFile() != cafile )
+    {
+        delete myTLS;
+        myTLS = new cTLS( cafile );
+    }
+    // the link owns the socket from here
+    myTLSLink = std::make_shared< sTLSLink >( mySocketTCP, myTLS->Context() );
+    SSL * ssl = myTLSLink->myStream.native_handle();
+    myTLS->Prepare( ssl, ip, port );
+    myTLSLink->myStream.set_verify_callback(
+        boost::asio::ssl::rfc2818_verification( ip ));
+
+    boost::system::error_code ec;
+    myTLSLink->myStream.handshake( boost::asio::ssl::stream_base::client, ec );
+    if( ec )
+    {
+        std::cout << "TLS " << ec.message() << "\n";
+        return false;
+    }
+    std::cout << "TLS " << SSL_get_version( ssl )
+              << ( cTLS::Resumed( ssl ) ? " session resumed" : " full handshake" )
+              << "\n";
+    return true;
+}
+
+void cNonBlockingTCPClient::Close()
+{
+    if( myTLSLink )
+    {
+        // mark TLS as shut down, otherwise OpenSSL discards the session and it cannot be resumed
+        SSL_set_shutdown(
+            myTLSLink->myStream.native_handle(),
+            SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN );
+
+        // abort pending operations, the stream and socket go when the last of their handlers has run
+        boost::system::error_code ec;
+        mySocketTCP->close( ec );
+        myTLSLink.reset();
+    }
+    else
+        cObjectCache< boost::asio::ip::tcp::tcp::socket >::Free( mySocketTCP );
+    mySocketTCP = 0;
+    myConnection = constatus::no;
+    myGeneration++;
+    mySlotPool->Cancel( this );
+    myfWriting = false;
+    myfFrameLoop = false;
+    myfReading = false;
+    myfIdle = false;
+    if( myScheduler )
+        myScheduler->Cancel( myShare );
+    myWriteQueue.clear();
+    if( myTimestamper )
+        myTimestamper->Disable();
+    FailRequests();
+
+    // a cancelled raw read no longer needs its buffer
+    myfRawRead = false;
+    ReleaseRcvBuffer();
+
+    // nothing left to freeze
+    if( myfFreezing )
+    {
+        myfFreezing = false;
+        Frozen();
+    }
+}
+
+void cNonBlockingTCPClient::Idle()
+{
+    if( myfIdle || myConnection != constatus::yes )
+        return;
+
+    if( ! myfRawRead )
+        ReleaseRcvBuffer();
+    std::vector< unsigned char >().swap( myResponsePayload );
+
+#ifdef __linux__
+    int fd = mySocketTCP->native_handle();
+    socklen_t len = sizeof( int );
+    if( getsockopt( fd, SOL_SOCKET, SO_RCVBUF, &myRcvBufferBytes, &len ) )
+        return;
+    len = sizeof( int );
+    if( getsockopt( fd, SOL_SOCKET, SO_SNDBUF, &mySndBufferBytes, &len ) )
+        return;
+    int small = IDLE_SOCKET_BUFFER_BYTES;
+    setsockopt( fd, SOL_SOCKET, SO_RCVBUF, &small, sizeof( small ));
+    setsockopt( fd, SOL_SOCKET, SO_SNDBUF, &small, sizeof( small ));
+#endif
+    myfIdle = true;
+}
+
+void cNonBlockingTCPClient::Wake()
+{
+    myfIdle = false;
+#ifdef __linux__
+    if( ! mySocketTCP )
+        return;
+
+    // the sizes stay locked, autotuning does not resume ( see Idle() )
+    // the kernel reports double what was set, to allow for its bookkeeping
+    int fd = mySocketTCP->native_handle();
+    int bytes = myRcvBufferBytes / 2;
+    setsockopt( fd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof( bytes ));
+    bytes = mySndBufferBytes / 2;
+    setsockopt( fd, SOL_SOCKET, SO_SNDBUF, &bytes, sizeof( bytes ));
+#endif
+}
+
+bool cNonBlockingTCPClient::Backlog()
+{
+    if( myTLSLink && SSL_pending( myTLSLink->myStream.native_handle() ) > 0 )
+        return true;
+    boost::system::error_code ec;
+    return mySocketTCP->available( ec ) > 0;
+}
+
+void cNonBlockingTCPClient::ReleaseRcvBuffer()
+{
+    mySlotPool->Release( myRcvBuffer );
+    myRcvBuffer = 0;
+}
+
+void cNonBlockingTCPClient::FailRequests()
+{
+    std::deque< response_t > failed;
+    failed.swap( myResponses );
+    std::vector< unsigned char > none;
+    for( auto& response : failed )
+        response( false, 0, none );
+}
+
+void cNonBlockingTCPClient::Read( int byte_count )
+{
+    if( myConnection != constatus::yes )
+    {
+        std::cout << "Read Request but no connection\n";
+        return;
+    }
+    if( myfFreezing )
+    {
+        std::cout << "Read Request but connection is being handed off\n";
+        return;
+    }
+    if( byte_count < 1 )
+    {
+        std::cout << "Error in read command\n";
+    }
+    if( byte_count > MAX_PACKET_SIZE_BYTES )
+    {
+        std::cout << "Too many bytes requested\n";
+        return;
+    }
+    if( myfRawRead )
+    {
+        std::cout << "Read already in progress\n";
+        return;
+    }
+    if( ! myRcvBuffer )
+        myRcvBuffer = mySlotPool->Acquire();
+    if( ! myRcvBuffer )
+    {
+        std::cout << "No receive buffer available\n";
+        return;
+    }
+    myfRawRead = true;
+    AsyncRead(
+        boost::asio::buffer(myRcvBuffer, byte_count ),
+        byte_count,
+        boost::bind(&cNonBlockingTCPClient::handle_read, this,
+                    boost::asio::placeholders::error,
+                    boost::asio::placeholders::bytes_transferred ));
+    std::cout << "waiting for server to reply\n";
+}
+
+void cNonBlockingTCPClient::ReadFrame()
+{
+    if( myConnection != constatus::yes )
+    {
+        std::cout << "Read Request but no connection\n";
+        return;
+    }
+    if( myfReading )
+    {
+        // the frame loop, or an earlier request, is already reading the next frame
+        std::cout << "Frame read already in progress\n";
+        return;
+    }
+    myfReading = true;
+    if( myTimestamper && ! myTLSLink )
+    {
+        // wait for the header to start arriving, so its arrival time can be peeked
+        mySocketTCP->async_wait(
+            boost::asio::ip::tcp::socket::wait_read,
+            [this]( const boost::system::error_code& error )
+        {
+            if( error )
+            {
+                handle_frame_header( error, 0 );
+                return;
+            }
+            myTimestamper->Arrival();
+            ReadHeader();
+        });
+        return;
+    }
+    ReadHeader();
+}
+
+void cNonBlockingTCPClient::ReadHeader()
+{
+    AsyncRead(
+        boost::asio::buffer(myFrameHeader.myBytes, FRAME_HEADER_BYTES ),
+        FRAME_HEADER_BYTES,
+        boost::bind(&cNonBlockingTCPClient::handle_frame_header, this,
+                    boost::asio::placeholders::error,
+                    boost::asio::placeholders::bytes_transferred ));
+}
+
+void cNonBlockingTCPClient::ReadFrames()
+{
+    if( myfFrameLoop )
+        return;
+    myfFrameLoop = true;
+    ReadFrame();
+}
+
+void cNonBlockingTCPClient::Send( frame_buffer_t frame )
+{
+    if( myfIdle )
+        Wake();
+    if( myfResumable )
+    {
+        // hold for acknowledgement, or for resume if disconnected
+        myUnacked.push_back( frame );
+    }
+    if( myConnection != constatus::yes )
+    {
+        if( ! myfResumable )
+            std::cout << "Send Request but no connection\n";
+        return;
+    }
+    myWriteQueue.push_back( frame );
+    if( ! myfWriting )
+        WriteNext();
+}
+
+void cNonBlockingTCPClient::Request(
+    frame_buffer_t frame,
+    response_t response )
+{
+    if( myConnection != constatus::yes || myfFreezing )
+    {
+        std::vector< unsigned char > none;
+        response( false, 0, none );
+        return;
+    }
+    myResponses.push_back( response );
+    ReadFrames();
+    Send( frame );
+}
+
+void cNonBlockingTCPClient::Acknowledge( unsigned int count )
+{
+    // sequence numbers wrap, so compare the difference
+    while( myUnacked.size() && (int)( count - myAckedSeq ) > 0 )
+    {
+        myUnacked.pop_front();
+        myAckedSeq++;
+    }
+    if( ! myfWriting )
+        WriteNext();
+}
+
+void cNonBlockingTCPClient::Resume()
+{
+    if( ! myfResumable )
+        return;
+    if( ! myUnacked.size() )
+    {
+        // nothing to resend, so no resume: the server starts a new session and counts from 0
+        myAckedSeq = 0;
+        return;
+    }
+    std::cout << "Resuming session, resending " << myUnacked.size()
+              << " frames from " << myAckedSeq << "\n";
+
+    unsigned char payload[4];
+    payload[0] = ( myAckedSeq >> 24 ) & 0xff;
+    payload[1] = ( myAckedSeq >> 16 ) & 0xff;
+    payload[2] = ( myAckedSeq >> 8 ) & 0xff;
+    payload[3] = myAckedSeq & 0xff;
+    std::vector< boost::asio::const_buffer > parts;
+    parts.push_back( boost::asio::buffer( payload ) );
+
+    // every queued frame is also held in myUnacked, so rebuild the queue from there
+    // the resume frame is not part of the sequence, so is not held in myUnacked
+    myWriteQueue.clear();
+    myWriteQueue.push_back( EncodeFrame( FRAME_TYPE_RESUME, parts ) );
+    myWriteQueue.insert( myWriteQueue.end(), myUnacked.begin(), myUnacked.end() );
+}
+
+void cNonBlockingTCPClient::Timestamping( bool f )
+{
+    if( f && ! myTimestamper )
+        myTimestamper = new cTimestamper();
+    else if( ! f )
+    {
+        delete myTimestamper;
+        myTimestamper = 0;
+    }
+}
+
+bool cNonBlockingTCPClient::Freeze( std::function< void() > frozen )
+{
+    if( myfRawRead )
+    {
+        // the bytes it has taken off the socket could not be handed over
+        return false;
+    }
+    myFrozen = frozen;
+    myfFreezing = true;
+    if( myConnection != constatus::yes )
+    {
+        Frozen();
+        return true;
+    }
+
+    // if a frame is being written WriteNext() continues when it completes
+    if( ! myfWriting )
+        FreezeReads();
+    return true;
+}
+
+void cNonBlockingTCPClient::FreezeReads()
+{
+    if( ! myfReading )
+    {
+        Frozen();
+        return;
+    }
+
+    // the read handlers complete any partly read frame, then call Frozen()
+    // no write is in progress, so only the read is cancelled
+    boost::system::error_code ec;
+    mySocketTCP->cancel( ec );
+}
+
+void cNonBlockingTCPClient::Frozen()
+{
+    if( ! myFrozen )
+        return;
+    std::function< void() > frozen;
+    frozen.swap( myFrozen );
+    frozen();
+}
+
+namespace
+{
+void Put32( std::vector< unsigned char >& v, unsigned int x )
+{
+    v.push_back( ( x >> 24 ) & 0xff );
+    v.push_back( ( x >> 16 ) & 0xff );
+    v.push_back( ( x >> 8 ) & 0xff );
+    v.push_back( x & 0xff );
+}
+void Put64( std::vector< unsigned char >& v, unsigned long long x )
+{
+    Put32( v, x >> 32 );
+    Put32( v, x & 0xffffffff );
+}
+void PutFrames( std::vector< unsigned char >& v, const std::deque< frame_buffer_t >& frames )
+{
+    Put32( v, frames.size() );
+    for( auto& f : frames )
+    {
+        Put32( v, f->size() );
+        v.insert( v.end(), f->begin(), f->end() );
+    }
+}
+
+/// reads state written by the Put functions, false once it runs short
+class cStateReader
+{
+public:
+    cStateReader( const std::vector< unsigned char >& v )
+        : myState( v )
+        , myPos( 0 )
+        , myfOK( true )
+    {
+
+    }
+    unsigned int Get32()
+    {
+        if( myPos + 4 > myState.size() )
+        {
+            myfOK = false;
+            return 0;
+        }
+        unsigned int x = ( myState[myPos] << 24 ) | ( myState[myPos+1] << 16 )
+                         | ( myState[myPos+2] << 8 ) | myState[myPos+3];
+        myPos += 4;
+        return x;
+    }
+    unsigned long long Get64()
+    {
+        unsigned long long x = Get32();
+        return ( x << 32 ) | Get32();
+    }
+    std::vector< unsigned char > GetBytes()
+    {
+        std::size_t length = Get32();
+        if( myPos + length > myState.size() )
+        {
+            myfOK = false;
+            return std::vector< unsigned char >();
+        }
+        myPos += length;
+        return std::vector< unsigned char >(
+                   myState.begin() + myPos - length,
+                   myState.begin() + myPos );
+    }
+    void GetFrames( std::deque< frame_buffer_t >& frames )
+    {
+        frames.clear();
+        unsigned int count = Get32();
+        for( unsigned int k = 0; k < count && myfOK; k++ )
+            frames.push_back( frame_buffer_t( new std::vector< unsigned char >( GetBytes() )));
+    }
+    bool OK() const
+    {
+        return myfOK;
+    }
+private:
+    const std::vector< unsigned char >& myState;
+    std::size_t myPos;
+    bool myfOK;
+};
+}
+
+bool cNonBlockingTCPClient::Export(
+    int& fd,
+    std::vector< unsigned char >& state )
+{
+#ifdef __linux__
+    if( myConnection != constatus::yes )
+        return false;
+    if( myTLSLink )
+    {
+        std::cout << "TLS connection cannot be handed off\n";
+        return false;
+    }
+    fd = dup( mySocketTCP->native_handle() );
+    if( fd < 0 )
+        return false;
+
+    state.clear();
+    Put32( state, ( myfResumable ? 1 : 0 ) | ( myfFrameLoop ? 2 : 0 ));
+    Put32( state, myServer.length() );
+    state.insert( state.end(), myServer.begin(), myServer.end() );
+    Put32( state, myAckedSeq );
+    Put64( state, myBytesRead );
+    Put64( state, myBytesWritten );
+    Put64( state, myFramesRead );
+    Put64( state, myFramesWritten );
+    PutFrames( state, myUnacked );
+    PutFrames( state, myWriteQueue );
+
+    // this process is finished with the connection, the duplicate keeps it open
+    myfFreezing = false;
+    myUnacked.clear();
+    Close();
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool cNonBlockingTCPClient::Adopt(
+    int fd,
+    const std::vector< unsigned char >& state )
+{
+#ifdef __linux__
+    cStateReader reader( state );
+    unsigned int flags = reader.Get32();
+    std::vector< unsigned char > server = reader.GetBytes();
+    unsigned int acked = reader.Get32();
+    unsigned long long counters[4];
+    for( auto& c : counters )
+        c = reader.Get64();
+    std::deque< frame_buffer_t > unacked, queue;
+    reader.GetFrames( unacked );
+    reader.GetFrames( queue );
+    if( ! reader.OK() )
+    {
+        std::cout << "Handoff state corrupt\n";
+        close( fd );
+        return false;
+    }
+
+    sockaddr_storage addr;
+    socklen_t len = sizeof( addr );
+    if( getsockname( fd, (sockaddr *) &addr, &len ) )
+    {
+        close( fd );
+        return false;
+    }
+    Close();
+    mySocketTCP = cObjectCache< boost::asio::ip::tcp::tcp::socket >::Allocate( myIOService );
+    boost::system::error_code ec;
+    mySocketTCP->assign(
+        addr.ss_family == AF_INET6 ? boost::asio::ip::tcp::v6() : boost::asio::ip::tcp::v4(),
+        fd, ec );
+    if( ec )
+    {
+        close( fd );
+        Close();
+        return false;
+    }
+
+    myConnection = constatus::yes;
+    myfResumable = flags & 1;
+    myServer.assign( server.begin(), server.end() );
+    myAckedSeq = acked;
+    myBytesRead = counters[0];
+    myBytesWritten = counters[1];
+    myFramesRead = counters[2];
+    myFramesWritten = counters[3];
+    myUnacked.swap( unacked );
+    myWriteQueue.swap( queue );
+    Touch();
+    std::cout << "Adopted connection to " << myServer
+              << ", " << myWriteQueue.size() << " frames queued, "
+              << myUnacked.size() << " unacknowledged\n";
+
+    if( flags & 2 )
+        ReadFrames();
+    WriteNext();
+    return true;
+#else
+    return false;
+#endif
+}
+
+void cNonBlockingTCPClient::WriteNext()
+{
+    cPerfStage perf( cPerfCounters::stage::write );
+    if( myfFreezing )
+    {
+        // leave the queue for export
+        myfWriting = false;
+        FreezeReads();
+        return;
+    }
+    if( myfResumable
+            && myUnacked.size() >= myWriteQueue.size() + RETRANSMIT_WINDOW_FRAMES )
+    {
+        // window of unacknowledged frames is full, wait for an acknowledgement
+        myfWriting = false;
+        return;
+    }
+    if( ! myWriteQueue.size() )
+    {
+        myfWriting = false;
+        if( myWriteIdle )
+            myWriteIdle();
+        return;
+    }
+    myfWriting = true;
+    AsyncWrite(
+        boost::asio::buffer( *myWriteQueue.front() ),
+        boost::bind(&cNonBlockingTCPClient::handle_send, this,
+                    boost::asio::placeholders::error,
+                    boost::asio::placeholders::bytes_transferred ));
+}
+
+void cNonBlockingTCPClient::Write()
+{
+    if( myConnection != constatus::yes )
+    {
+        std::cout << "Write Request but no connection\n";
+        return;
+    }
+    AsyncWrite(
+        boost::asio::buffer(myWriteMessage, 15),
+        boost::bind(&cNonBlockingTCPClient::handle_write, this,
+                    boost::asio::placeholders::error,
+                    boost::asio::placeholders::bytes_transferred ));
+}
+
+void cNonBlockingTCPClient::handle_read(
+    const boost::system::error_code& error,
+    std::size_t bytes_received )
+{
+    if( error == boost::asio::error::operation_aborted )
+    {
+        // Close() cancelled the read, the client may already be on a new connection
+        return;
+    }
+    myfRawRead = false;
+    if( error )
+    {
+        std::cout << "Connection closed\n";
+        myConnection = constatus::no;
+        return;
+    }
+    myBytesRead += bytes_received;
+    Touch();
+    std::cout << bytes_received << " bytes read\n";
+    for( int k = 0; k < bytes_received; k++ )
+        std::cout << std::hex << (int)myRcvBuffer[k] << " ";
+    std::cout << std::dec << "\n";
+}
+
+void cNonBlockingTCPClient::handle_frame_header(
+    const boost::system::error_code& error,
+    std::size_t bytes_received )
+{
+    cPerfStage perf( cPerfCounters::stage::read );
+    myfReading = false;
+    if( error == boost::asio::error::operation_aborted && myfFreezing && mySocketTCP )
+    {
+        // FreezeReads() cancelled the read
+        if( ! bytes_received )
+        {
+            // at a frame boundary
+            Frozen();
+            return;
+        }
+
+        // part of a header has arrived, complete the frame
+        myfReading = true;
+        AsyncRead(
+            boost::asio::buffer( myFrameHeader.myBytes + bytes_received, FRAME_HEADER_BYTES - bytes_received ),
+            FRAME_HEADER_BYTES - bytes_received,
+            [this, bytes_received]( const boost::system::error_code& error, std::size_t n )
+        {
+            handle_frame_header( error, bytes_received + n );
+        });
+        return;
+    }
+    if( error == boost::asio::error::operation_aborted )
+    {
+        // Close() cancelled the read, the client may already be on a new connection
+        return;
+    }
+    if( error )
+    {
+        std::cout << "Connection closed\n";
+        myConnection = constatus::no;
+        FailRequests();
+        if( myfFreezing )
+            Frozen();
+        return;
+    }
+    if( ! myFrameHeader.IsValid() )
+    {
+        std::cout << "Invalid frame header, closing connection\n";
+        Close();
+        return;
+    }
+    std::size_t length = myFrameHeader.Length();
+
+    // ask the consumer where the payload should go
+    myFramePayload.clear();
+    if( myFrameHeader.Type() == FRAME_TYPE_ACK && length == sizeof( myAckIn ) )
+        myFramePayload.push_back( boost::asio::buffer( myAckIn ) );
+    else if( myFrameDest )
+        myFramePayload = myFrameDest( myFrameHeader.Type(), length );
+
+    if( ! myFramePayload.size() )
+    {
+        // no consumer supplied destination, use a pool slot
+        if( length > mySlotPool->SlotBytes() )
+        {
+            std::cout << "Frame payload too large for pool slot, closing connection\n";
+            Close();
+            return;
+        }
+        ReadFrameSlot();
+        return;
+    }
+    if( boost::asio::buffer_size( myFramePayload ) < length )
+    {
+        std::cout << "Frame destination too small, closing connection\n";
+        Close();
+        return;
+    }
+    ReadFramePayload();
+}
+
+void cNonBlockingTCPClient::ReadFrameSlot()
+{
+    myfReading = true;
+    if( myfOwnPool )
+        mySlot = mySlotPool->Acquire();
+    else
+    {
+        unsigned int generation = myGeneration;
+        mySlot = mySlotPool->Acquire( this, [this, generation]()
+        {
+            // a slot has been released, perhaps by another thread, try again in ours
+            myIOService.post( [this, generation]()
+            {
+                // the connection the wait was for may have closed since, then the next waiter has the slot
+                if( generation == myGeneration && myfReading )
+                    ReadFrameSlot();
+                else
+                    mySlotPool->Pass();
+            });
+        });
+
+        // every shared slot is mid frame on another connection, wait until one is released
+        if( ! mySlot )
+            return;
+    }
+    if( ! mySlot )
+    {
+        std::cout << "Frame slot pool exhausted, closing connection\n";
+        Close();
+        return;
+    }
+    myFramePayload.push_back( boost::asio::buffer( mySlot, myFrameHeader.Length() ) );
+    ReadFramePayload();
+}
+
+void cNonBlockingTCPClient::ReadFramePayload()
+{
+    // scatter read payload directly into its destination
+    myfReading = true;
+    AsyncRead(
+        myFramePayload,
+        myFrameHeader.Length(),
+        boost::bind(&cNonBlockingTCPClient::handle_frame_payload, this,
+                    boost::asio::placeholders::error,
+                    boost::asio::placeholders::bytes_transferred ));
+}
+
+void cNonBlockingTCPClient::handle_frame_payload(
+    const boost::system::error_code& error,
+    std::size_t bytes_received )
+{
+    cPerfStage perf( cPerfCounters::stage::decode );
+    myfReading = false;
+    if( error == boost::asio::error::operation_aborted && myfFreezing && mySocketTCP )
+    {
+        // FreezeReads() cancelled the read part way through the payload, complete the frame
+        std::size_t length = myFrameHeader.Length();
+        std::vector< boost::asio::mutable_buffer > rest;
+        std::size_t skip = bytes_received;
+        for( auto& b : myFramePayload )
+        {
+            std::size_t size = boost::asio::buffer_size( b );
+            if( skip >= size )
+            {
+                skip -= size;
+                continue;
+            }
+            rest.push_back( b + skip );
+            skip = 0;
+        }
+        myfReading = true;
+        AsyncRead(
+            rest,
+            length - bytes_received,
+            [this, bytes_received]( const boost::system::error_code& error, std::size_t n )
+        {
+            handle_frame_payload( error, bytes_received + n );
+        });
+        return;
+    }
+    if( error == boost::asio::error::operation_aborted )
+    {
+        // Close() cancelled the read, the client may already be on a new connection
+        mySlotPool->Release( mySlot );
+        mySlot = 0;
+        return;
+    }
+    if( error )
+    {
+        std::cout << "Connection closed\n";
+        myConnection = constatus::no;
+        FailRequests();
+    }
+    else
+    {
+        myBytesRead += FRAME_HEADER_BYTES + bytes_received;
+        myFramesRead++;
+        cPerfCounters::Frame();
+        Touch();
+
+        if( myFrameHeader.Type() == FRAME_TYPE_ACK && bytes_received == sizeof( myAckIn ) )
+            Acknowledge(
+                ( myAckIn[0] << 24 ) | ( myAckIn[1] << 16 )
+                | ( myAckIn[2] << 8 ) | myAckIn[3] );
+        else if( myResponses.size() && myFrameHeader.Type() < FRAME_TYPE_PROTOCOL )
+        {
+            // copied into a buffer kept from one response to the next, so only a larger response allocates
+            myResponsePayload.resize( bytes_received );
+            boost::asio::buffer_copy( boost::asio::buffer( myResponsePayload ), myFramePayload, bytes_received );
+            response_t response = myResponses.front();
+            myResponses.pop_front();
+            perf.Next( cPerfCounters::stage::dispatch );
+            response( true, myFrameHeader.Type(), myResponsePayload );
+        }
+        else if( myFrameHandler )
+        {
+            perf.Next( cPerfCounters::stage::dispatch );
+            myFrameHandler( myFrameHeader.Type(), myFramePayload, bytes_received );
+        }
+        else
+            std::cout << "frame type " << std::hex << myFrameHeader.Type()
+                      << std::dec << " " << bytes_received << " bytes\n";
+    }
+
+    mySlotPool->Release( mySlot );
+    mySlot = 0;
+
+    if( myTimestamper )
+    {
+        myTimestamper->Dispatched();
+        myTimestamper->Drain();
+    }
+
+    if( myfFreezing )
+    {
+        // at a frame boundary
+        Frozen();
+        return;
+    }
+    if( myfFrameLoop && myConnection == constatus::yes )
+    {
+        if( myScheduler && ! error && ! Backlog() )
+        {
+            // caught up, the next frame starts a new burst
+            myScheduler->Rest( myShare );
+        }
+        else if( myScheduler && ! error
+                 && ! myScheduler->Charge( myShare, FRAME_HEADER_BYTES + bytes_received ))
+        {
+            // used up its turn, let the other connections read before the next frame
+            myScheduler->Yield( myShare, [this]()
+            {
+                if( myfFrameLoop && myConnection == constatus::yes
+                        && ! myfReading && ! myfFreezing )
+                    ReadFrame();
+            });
+            return;
+        }
+        ReadFrame();
+    }
+}
+
+void cNonBlockingTCPClient::handle_send(
+    const boost::system::error_code& error,
+    std::size_t bytes_sent )
+{
+    if( error == boost::asio::error::operation_aborted )
+    {
+        // socket was closed under the write, Close() has cleared the queue
+        return;
+    }
+    if( error )
+    {
+        std::cout << "Error sending frame to server\n";
+        myConnection = constatus::no;
+        myfWriting = false;
+        myWriteQueue.clear();
+        return;
+    }
+    myBytesWritten += bytes_sent;
+    myFramesWritten++;
+    Touch();
+
+    // release frame, the buffer is freed if nothing else holds it
+    myWriteQueue.pop_front();
+
+    if( myTimestamper )
+        myTimestamper->Drain();
+
+    WriteNext();
+}
+
+void cNonBlockingTCPClient::handle_connect_write(
+    const boost::system::error_code& error,
+    std::size_t bytes_sent )
+{
+    if( error == boost::asio::error::operation_aborted )
+    {
+        // socket was closed under the write, the client may already be on a new connection
+        return;
+    }
+    if( error || bytes_sent != 15 )
+    {
+        std::cout << "Error sending connection message to server\n";
+        myConnection = constatus::no;
+        return;
+    }
+    myBytesWritten += bytes_sent;
+    myFramesWritten++;
+    Touch();
+    std::cout << "Connection message sent to server\n";
+
+    myfWriting = false;
+    Resume();
+    if( myfResumable )
+    {
+        // acknowledgements only arrive while frames are being read
+        ReadFrames();
+    }
+    if( ! myfWriting )
+        WriteNext();
+}
+
+void cNonBlockingTCPClient::handle_write(
+    const boost::system::error_code& error,
+    std::size_t bytes_sent )
+{
+    if( error == boost::asio::error::operation_aborted )
+        return;
+    if( error || bytes_sent != 15 )
+    {
+        std::cout << "Error sending write message to server\n";
+        myConnection = constatus::no;
+        return;
+    }
+    myBytesWritten += bytes_sent;
+    myFramesWritten++;
+    Touch();
+    std::cout << "Write message sent to server\n";
+}
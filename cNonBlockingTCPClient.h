@@ -0,0 +1,645 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <deque>
+#include <memory>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+
+#include "frame.h"
+#include "cConnectionTable.h"
+#include "cTLS.h"
+#include "cTimestamper.h"
+#include "cSourcePool.h"
+#include "cFairScheduler.h"
+
+#define MAX_PACKET_SIZE_BYTES 1024
+
+// number of pool slots that frame payloads can be read into
+// a connection reads one frame at a time and the slot is returned when the handler returns
+#define FRAME_SLOT_COUNT 1
+
+// payload type of a frame acknowledging frames received: count of frames received this session (4)
+#define FRAME_TYPE_ACK 0xF003
+
+// payload type of a frame resuming a session on a new connection: sequence number of next frame (4)
+#define FRAME_TYPE_RESUME 0xF004
+
+// payload types from here up are this client's own protocol, below are application frames
+#define FRAME_TYPE_PROTOCOL 0xF000
+
+// maximum frames written but not yet acknowledged
+#define RETRANSMIT_WINDOW_FRAMES 4096
+
+// cache line size used to separate hot and cold state
+#define CACHE_LINE_BYTES 64
+
+// kernel send and receive buffer size requested for an idle connection
+#define IDLE_SOCKET_BUFFER_BYTES 4096
+
+/** TLS stream over a connection's socket
+
+    Owns the socket once the stream is built on it, and is shared with the stream's
+    pending handlers, so that a closed connection's stream and socket outlive
+    the aborted operations that still use them.
+*/
+struct sTLSLink
+{
+    boost::asio::ip::tcp::socket * mySocket;
+    boost::asio::ssl::stream< boost::asio::ip::tcp::socket& > myStream;
+
+    sTLSLink(
+        boost::asio::ip::tcp::socket * socket,
+        boost::asio::ssl::context& context )
+        : mySocket( socket )
+        , myStream( *socket, context )
+    {
+
+    }
+
+    /// returns the socket to the object cache
+    ~sTLSLink();
+};
+
+/** A non-blocking TCP client
+
+    The members are laid out so that the state touched on every read and write
+    shares one cache line, the counters sit on a line of their own,
+    and the rarely used state follows.
+*/
+class cNonBlockingTCPClient
+{
+public:
+
+    /** CTOR
+        param[in] io_service the event manager
+        param[in] arena buffer arena to carve the client's own frame slot pool from, 0 for heap
+        param[in] table connection table to register in, 0 for none
+        param[in] pool frame slot pool shared by connections, 0 for a pool of the connection's own
+
+        With a shared pool a connection holds no buffer of its own while it is quiet.
+    */
+
+    cNonBlockingTCPClient(
+        boost::asio::io_service& io_service,
+        cBufferArena * arena = 0,
+        cConnectionTable * table = 0,
+        cFrameSlotPool * pool = 0 )
+        : mySocketTCP( 0 )
+        , myRcvBuffer( 0 )
+        , mySlot( 0 )
+        , myConnection( constatus::no )
+        , myTableSlot( -1 )
+        , myfWriting( false )
+        , myfFrameLoop( false )
+        , myfResumable( false )
+        , myfReading( false )
+        , myfFreezing( false )
+        , myfIdle( false )
+        , myGeneration( 0 )
+        , myAckedSeq( 0 )
+        , myBytesRead( 0 )
+        , myBytesWritten( 0 )
+        , myFramesRead( 0 )
+        , myFramesWritten( 0 )
+        , myIOService( io_service )
+        , mySlotPool( pool )
+        , myfOwnPool( ! pool )
+        , myfRawRead( false )
+        , myRcvBufferBytes( 0 )
+        , mySndBufferBytes( 0 )
+        , myTable( table )
+        , myTLS( 0 )
+        , myTimestamper( 0 )
+        , mySource( 0 )
+        , myScheduler( 0 )
+        , myNode( arena ? arena->Node() : -1 )
+    {
+        // a pool of its own has a slot for frames and one for raw reads
+        if( myfOwnPool )
+            mySlotPool = new cFrameSlotPool( FRAME_SLOT_COUNT + 1, MAX_PACKET_SIZE_BYTES, arena );
+        if( myTable )
+            myTableSlot = myTable->Add( this );
+    }
+
+    ~cNonBlockingTCPClient()
+    {
+        if( myScheduler )
+            myScheduler->Cancel( myShare );
+        mySlotPool->Cancel( this );
+
+        // so sweeps of the table do not reach a deleted client
+        if( myTable )
+            myTable->Remove( myTableSlot );
+        ReleaseRcvBuffer();
+        if( myfOwnPool )
+            delete mySlotPool;
+
+        // sessions hold their own reference to the context, so a live link outlives this
+        delete myTLS;
+        delete myTimestamper;
+    }
+
+    /** Memory used by one connection
+        @return bytes, including buffers and socket when connected
+    */
+    std::size_t Footprint() const;
+
+    /** Provides the location a frame payload is to be read into
+
+        @param[in] type of payload, from frame header
+        @param[in] length of payload, from frame header
+        @return buffer sequence, total size at least length.
+
+        Return an empty sequence to have the payload read into a pool slot
+    */
+    typedef std::function< std::vector< boost::asio::mutable_buffer >(
+        int type,
+        std::size_t length ) > frame_dest_t;
+
+    /** Called when a complete frame has been read
+
+        @param[in] type of payload
+        @param[in] payload buffer sequence holding payload
+        @param[in] length of payload
+
+        If the payload was read into a pool slot,
+        the slot is returned to the pool when the handler returns.
+    */
+    typedef std::function< void(
+        int type,
+        const std::vector< boost::asio::mutable_buffer >& payload,
+        std::size_t length ) > frame_handler_t;
+
+    /// Register location provider for frame payloads
+    void FrameDestination( frame_dest_t dest )
+    {
+        myFrameDest = dest;
+    }
+
+    /// Register frame handler
+    void FrameHandler( frame_handler_t handler )
+    {
+        myFrameHandler = handler;
+    }
+
+    /** Bind connections to local addresses from a pool
+        @param[in] pool of source addresses, 0 to leave the choice to the kernel
+    */
+    void SourcePool( cSourcePool * pool )
+    {
+        mySource = pool;
+    }
+
+    /** Share the event manager fairly with other connections reading frames continuously
+        @param[in] scheduler shared by the connections, 0 to read on without yielding
+    */
+    void FairScheduler( cFairScheduler * scheduler )
+    {
+        myScheduler = scheduler;
+    }
+
+    /** Connect to server
+        @param[in] ip address of server
+        @param[in] port server is listening to for connections
+        @param[in] tls true to run the connection over TLS
+        @param[in] cafile trusted certificates for TLS, empty for system default
+
+        This does not return until the connection attempt successds or fails.
+        The return occurs so quickly that it does not seem wiorthwhile
+        to make this non-blocking.
+
+        With TLS the handshake is also completed before return.
+        A reconnect to the same server resumes the previous TLS session.
+
+        On successful connection a pre-defined message is sent to the server
+        this is non-blocking and when the message has been sent handle_connect_write() will be called
+    */
+    void Connect(
+        const std::string& ip,
+        const std::string& port,
+        bool tls = false,
+        const std::string& cafile = "" );
+
+    /** read message from server
+        @param[in] byte_count to be read
+
+        This is non-blocking, returning immediatly.
+        When sufficient bytes arrive from the server
+        the method handle_read() will be called
+    */
+    void Read( int byte_count );
+
+    /** read one frame from server
+
+        This is non-blocking, returning immediatly.
+        When the frame header arrives handle_frame_header() parses it
+        and the payload is read straight into the location
+        provided by the registered frame_dest_t, or into a pool slot.
+        When the payload arrives the registered frame_handler_t is called.
+
+        Does nothing if a frame is already being read, e.g. by ReadFrames().
+        A malformed frame, or one with nowhere to go, closes the connection.
+    */
+    void ReadFrame();
+
+    /** read frames from server continuously
+
+        Like ReadFrame() but the next frame is read as soon as
+        the frame handler returns, until the connection closes.
+        With a FairScheduler() the connection yields after each turn's budget.
+    */
+    void ReadFrames();
+
+    /** queue frame for sending to server
+        @param[in] frame encoded frame
+
+        This is non-blocking, returning immediatly.
+        Frames are written one at a time in the order they were queued.
+        The frame is held until its write completes.
+        When the queue empties the registered write idle handler is called.
+    */
+    void Send( frame_buffer_t frame );
+
+    /** Keep frames until the server acknowledges them, and resend the unacknowledged after reconnecting
+        @param[in] f true to enable
+
+        Frames queued by Send() are numbered from 0 at the start of a session.
+        The server sends FRAME_TYPE_ACK frames with the count of frames it has processed,
+        and acknowledged frames are released.  At most RETRANSMIT_WINDOW_FRAMES are written
+        ahead of the acknowledgements.  Each connection starts ReadFrames(),
+        so that acknowledgements are read even by a client that only writes.
+
+        When Connect() reaches the same server again, it sends FRAME_TYPE_RESUME
+        with the sequence number of the first unacknowledged frame, then resends
+        from that frame on.  Frames sent while disconnected wait for the reconnect.
+        Connecting to a different server starts a new session.
+    */
+    void Resumable( bool f )
+    {
+        myfResumable = f;
+    }
+
+    /// Number of frames held for acknowledgement
+    std::size_t Unacknowledged() const
+    {
+        return myUnacked.size();
+    }
+
+    /** Called with the response to a request
+
+        @param[in] ok false if the connection closed before the response arrived
+        @param[in] type of response payload
+        @param[in] payload response payload
+    */
+    typedef std::function< void(
+        bool ok,
+        int type,
+        const std::vector< unsigned char >& payload ) > response_t;
+
+    /** send request to server and wait for its response
+        @param[in] frame encoded request
+        @param[in] response called when the response arrives
+
+        This is non-blocking, returning immediatly.
+        The server answers requests in order, so the response to the oldest
+        outstanding request is the next application frame,
+        one with a type below FRAME_TYPE_PROTOCOL.
+        While requests are outstanding, application frames go to the response handlers
+        instead of the frame handler.
+    */
+    void Request(
+        frame_buffer_t frame,
+        response_t response );
+
+    /// Number of requests waiting for their response
+    std::size_t Outstanding() const
+    {
+        return myResponses.size();
+    }
+
+    /// Register handler called when the write queue empties
+    void WriteIdleHandler( std::function< void() > handler )
+    {
+        myWriteIdle = handler;
+    }
+
+    /// Register handler called when Connect() makes a new connection, the peer starts afresh
+    void ConnectHandler( std::function< void() > handler )
+    {
+        myConnected = handler;
+    }
+
+    /// Number of frames queued or being written
+    std::size_t WriteQueueSize() const
+    {
+        return myWriteQueue.size();
+    }
+
+    /** Timestamp traffic in the kernel, or NIC, to tell network latency from processing latency
+        @param[in] f true to enable
+
+        Takes effect from the next plaintext connection.  See cTimestamper.
+    */
+    void Timestamping( bool f );
+
+    /// Timestamp histograms, 0 if timestamping is not enabled
+    const cTimestamper * Timestamps() const
+    {
+        return myTimestamper;
+    }
+
+    /// Bytes read from server, including frame headers
+    unsigned long long BytesRead() const
+    {
+        return myBytesRead;
+    }
+
+    /// Bytes written to server
+    unsigned long long BytesWritten() const
+    {
+        return myBytesWritten;
+    }
+
+    /// Frames read from server
+    unsigned long long FramesRead() const
+    {
+        return myFramesRead;
+    }
+
+    /// Frames written to server
+    unsigned long long FramesWritten() const
+    {
+        return myFramesWritten;
+    }
+
+    /// close connection and release socket, outstanding reads and writes are cancelled
+    void Close();
+
+    /** Connection has gone quiet, release what it does not need until it is busy again
+
+        The raw read buffer goes back to the slot pool, the response buffer is freed, and the kernel send and receive buffers
+        are shrunk to IDLE_SOCKET_BUFFER_BYTES.  The next read or write completion,
+        or the next Send(), restores the kernel buffers and the raw read buffer is reacquired
+        by the next Read().
+
+        Once the buffer sizes have been set the kernel no longer tunes them automatically,
+        and there is no way to hand them back, so they are restored to the sizes they had
+        when the connection went quiet and stay fixed there.  This is a trade-off:
+        a connection that later needs more throughput than it had reached by then
+        is limited to those sizes, in return for quiet connections holding little kernel memory.
+        Do not call Idle() on connections whose throughput varies widely.
+    */
+    void Idle();
+
+    /// true if Idle() has released the connection's buffers
+    bool IsIdle() const
+    {
+        return myfIdle;
+    }
+
+    bool IsConnected() const
+    {
+        return myConnection == constatus::yes;
+    }
+
+    /** Bring the connection to rest, ready to be handed to another process
+        @param[in] frozen called once the connection is at rest
+        @return false if a Read() is in progress, the connection carries on unchanged
+
+        The frame being written, and the frame being read, are completed.
+        No further frames are written or read, frames sent meanwhile stay queued.
+        Requests and Read() sent meanwhile fail.
+    */
+    bool Freeze( std::function< void() > frozen );
+
+    /** Export frozen connection
+        @param[out] fd duplicate of the socket, the caller owns it
+        @param[out] state session state, sequence and acknowledgement numbers and queued frames
+        @return true if successful
+
+        The connection here is closed, but the socket stays connected through fd.
+        Outstanding requests fail, their responses go to whoever adopts the connection.
+        A TLS connection cannot be exported, its keys live in this process's OpenSSL.
+    */
+    bool Export(
+        int& fd,
+        std::vector< unsigned char >& state );
+
+    /** Adopt connection exported by another process
+        @param[in] fd connected socket, ownership passes to the client
+        @param[in] state from Export()
+        @return true if successful
+
+        Writing of the queued frames, and reading, resume where they stopped.
+    */
+    bool Adopt(
+        int fd,
+        const std::vector< unsigned char >& state );
+
+    /** write pre-defined message to server
+
+        This is non-blocking, returning immediatly.
+        When write completes
+        the method handle_write() will be called
+    */
+    void Write();
+
+
+private:
+    enum class constatus : unsigned char
+    {
+        no,                             /// there is no connection
+        yes,                            /// connected
+        not_yet                          /// Connection is being made, not yet complete
+    };
+
+    // hot state, used on every read and write
+    alignas( CACHE_LINE_BYTES )
+    boost::asio::ip::tcp::tcp::socket * mySocketTCP;
+    std::shared_ptr< sTLSLink > myTLSLink;      /// TLS over mySocketTCP, empty for plaintext
+    unsigned char * myRcvBuffer;
+    unsigned char * mySlot;             /// pool slot holding payload being read, or 0
+    constatus myConnection;
+    int myTableSlot;                    /// slot in connection table, -1 if none
+    bool myfWriting;                    /// true while the front of myWriteQueue is being written
+    bool myfFrameLoop;                  /// true to read frames continuously
+    bool myfResumable;                  /// true to keep frames for retransmission
+    bool myfReading;                    /// true while a frame read is in progress
+    bool myfFreezing;                   /// true while bringing the connection to rest for handoff
+    bool myfIdle;                       /// true while buffers are released by Idle()
+    unsigned int myGeneration;          /// counts Close()s, so a handler posted for an earlier connection can tell
+    unsigned int myAckedSeq;            /// frames of this session acknowledged by server
+    cFrameHeader myFrameHeader;
+    std::deque< frame_buffer_t > myWriteQueue;
+    std::deque< frame_buffer_t > myUnacked;     /// frames from sequence number myAckedSeq on, not yet acknowledged
+    unsigned char myAckIn[4];
+
+    // counters, on their own line so a reader elsewhere does not stall the hot state
+    alignas( CACHE_LINE_BYTES )
+    unsigned long long myBytesRead;
+    unsigned long long myBytesWritten;
+    unsigned long long myFramesRead;
+    unsigned long long myFramesWritten;
+
+    // cold state
+    alignas( CACHE_LINE_BYTES )
+    boost::asio::io_service& myIOService;
+    cFrameSlotPool * mySlotPool;        /// where payloads and raw reads go
+    bool myfOwnPool;                    /// true if mySlotPool belongs to this connection
+    bool myfRawRead;                    /// true while Read() is using myRcvBuffer
+    int myRcvBufferBytes;               /// kernel buffer sizes before Idle() shrank them
+    int mySndBufferBytes;
+    std::vector< boost::asio::mutable_buffer > myFramePayload;
+    frame_dest_t myFrameDest;
+    frame_handler_t myFrameHandler;
+    std::deque< response_t > myResponses;       /// handlers of outstanding requests, oldest first
+    std::vector< unsigned char > myResponsePayload;     /// response being handed to its handler
+    std::function< void() > myWriteIdle;
+    std::function< void() > myConnected;
+    std::function< void() > myFrozen;           /// called when freeze completes
+    cConnectionTable * myTable;
+    cTLS * myTLS;                       /// TLS configuration, created on first TLS connect
+    cTimestamper * myTimestamper;       /// kernel timestamps of traffic, 0 if not wanted
+    cSourcePool * mySource;             /// local addresses to bind to, or 0
+    cFairScheduler * myScheduler;       /// shares event manager between busy connections, or 0
+    sFairShare myShare;                 /// this connection's share
+    int myNode;                         /// NUMA node buffers are placed on, -1 if unknown
+    std::string myServer;               /// ip:port of server the session is with
+
+    // pre-defined messages, the same for every connection
+    static const unsigned char myConnectMessage[15];
+    static const unsigned char myWriteMessage[15];
+
+    /// write to server, through TLS if connection is encrypted
+    template< class Buffers, class Handler >
+    void AsyncWrite(
+        const Buffers& buffers,
+        Handler handler )
+    {
+        if( myTimestamper )
+            myTimestamper->Submitted( boost::asio::buffer_size( buffers ));
+        if( myTLSLink )
+        {
+            // the handler keeps the stream alive until it has run
+            std::shared_ptr< sTLSLink > link = myTLSLink;
+            boost::asio::async_write( link->myStream, buffers,
+                                      [link, handler]( const boost::system::error_code& error, std::size_t n )
+            {
+                handler( error, n );
+            });
+        }
+        else
+            boost::asio::async_write( *mySocketTCP, buffers, handler );
+    }
+
+    /// read from server, through TLS if connection is encrypted
+    template< class Buffers, class Handler >
+    void AsyncRead(
+        const Buffers& buffers,
+        std::size_t byte_count,
+        Handler handler )
+    {
+        if( myTLSLink )
+        {
+            std::shared_ptr< sTLSLink > link = myTLSLink;
+            boost::asio::async_read( link->myStream, buffers,
+                                     boost::asio::transfer_exactly( byte_count ),
+                                     [link, handler]( const boost::system::error_code& error, std::size_t n )
+            {
+                handler( error, n );
+            });
+        }
+        else
+            boost::asio::async_read( *mySocketTCP, buffers,
+                                     boost::asio::transfer_exactly( byte_count ), handler );
+    }
+
+    /** Connect socket from an address in the source pool
+        @param[in] server to connect to
+        @param[out] ec error
+    */
+    void ConnectFrom(
+        const boost::asio::ip::tcp::endpoint& server,
+        boost::system::error_code& ec );
+
+    /** Complete TLS handshake on newly connected socket
+        @return true if successful
+    */
+    bool Handshake(
+        const std::string& ip,
+        const std::string& port,
+        const std::string& cafile );
+
+    /// record activity in connection table
+    void Touch()
+    {
+        if( myTable )
+            myTable->Touch( myTableSlot );
+        if( myfIdle )
+            Wake();
+    }
+
+    /// connection is busy again, restore kernel buffers shrunk by Idle()
+    void Wake();
+
+    /// true if more has arrived from the server than has been read
+    bool Backlog();
+
+    /// return raw read buffer to pool
+    void ReleaseRcvBuffer();
+
+    void handle_read(
+        const boost::system::error_code& error,
+        std::size_t bytes_received );
+
+    /// start reading frame header
+    void ReadHeader();
+
+    void handle_frame_header(
+        const boost::system::error_code& error,
+        std::size_t bytes_received );
+
+    /// read payload of frame into a pool slot, waiting for one if the shared pool is empty
+    void ReadFrameSlot();
+
+    /// read payload of frame into myFramePayload
+    void ReadFramePayload();
+
+    void handle_frame_payload(
+        const boost::system::error_code& error,
+        std::size_t bytes_received );
+
+    /// start writing front of write queue
+    void WriteNext();
+
+    /// fail outstanding requests
+    void FailRequests();
+
+    /// release frames acknowledged by server
+    void Acknowledge( unsigned int count );
+
+    /// queue resume frame and unacknowledged frames after reconnect
+    void Resume();
+
+    /// writes have stopped, stop reads at the next frame boundary
+    void FreezeReads();
+
+    /// freeze complete, tell whoever asked
+    void Frozen();
+
+    void handle_send(
+        const boost::system::error_code& error,
+        std::size_t bytes_sent );
+
+    void handle_connect_write(
+        const boost::system::error_code& error,
+        std::size_t bytes_sent );
+
+    void handle_write(
+        const boost::system::error_code& error,
+        std::size_t bytes_sent );
+};
@@ -0,0 +1,151 @@
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#include "cNuma.h"
+
+std::vector< int > cNuma::Nodes()
+{
+    // node numbers can have gaps, e.g. "0,2" after a node is offlined
+    std::ifstream f( "/sys/devices/system/node/online" );
+    std::string list;
+    getline( f, list );
+    std::vector< int > nodes = ParseCPUList( list );
+    if( ! nodes.size() )
+        nodes.push_back( 0 );
+    return nodes;
+}
+
+int cNuma::NodeCount()
+{
+    return Nodes().size();
+}
+
+std::vector< int > cNuma::NodeCPUs( int node )
+{
+    std::ifstream f(
+        "/sys/devices/system/node/node" + std::to_string( node ) + "/cpulist" );
+    std::string list;
+    getline( f, list );
+    return ParseCPUList( list );
+}
+
+std::vector< int > cNuma::ParseCPUList( const std::string& list )
+{
+    std::vector< int > cpus;
+    std::stringstream sst( list );
+    std::string range;
+    while( getline( sst, range, ',' ) )
+    {
+        if( ! range.length() )
+            continue;
+        int first, last;
+        std::size_t dash = range.find( '-' );
+        first = atoi( range.c_str() );
+        if( dash == std::string::npos )
+            last = first;
+        else
+            last = atoi( range.substr( dash + 1 ).c_str() );
+        for( int cpu = first; cpu <= last; cpu++ )
+            cpus.push_back( cpu );
+    }
+    return cpus;
+}
+
+int cNuma::NICNode( const std::string& ifname )
+{
+    std::ifstream f( "/sys/class/net/" + ifname + "/device/numa_node" );
+    if( ! f.is_open() )
+        return -1;
+    int node = -1;
+    f >> node;
+    return node;
+}
+
+std::string cNuma::SocketInterface( int fd )
+{
+#ifdef __linux__
+    // find local address the connection is bound to
+    sockaddr_storage local;
+    socklen_t len = sizeof( local );
+    if( getsockname( fd, (sockaddr*) &local, &len ) )
+        return "";
+
+    // find the interface that owns the address
+    ifaddrs * list;
+    if( getifaddrs( &list ) )
+        return "";
+    std::string ifname;
+    for( ifaddrs * ifa = list; ifa; ifa = ifa->ifa_next )
+    {
+        if( ! ifa->ifa_addr || ifa->ifa_addr->sa_family != local.ss_family )
+            continue;
+        bool match = false;
+        if( local.ss_family == AF_INET )
+            match = ( (sockaddr_in*) ifa->ifa_addr )->sin_addr.s_addr
+                    == ( (sockaddr_in*) &local )->sin_addr.s_addr;
+        else if( local.ss_family == AF_INET6 )
+            match = ! memcmp(
+                        &( (sockaddr_in6*) ifa->ifa_addr )->sin6_addr,
+                        &( (sockaddr_in6*) &local )->sin6_addr,
+                        sizeof( in6_addr ) );
+        if( match )
+        {
+            ifname = ifa->ifa_name;
+            break;
+        }
+    }
+    freeifaddrs( list );
+    return ifname;
+#else
+    return "";
+#endif
+}
+
+int cNuma::SocketNode( int fd )
+{
+    std::string ifname = SocketInterface( fd );
+    if( ! ifname.length() )
+        return -1;
+    return NICNode( ifname );
+}
+
+bool cNuma::PinThisThread( int node )
+{
+#ifdef __linux__
+    std::vector< int > cpus = NodeCPUs( node );
+    if( ! cpus.size() )
+        return false;
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    for( int cpu : cpus )
+        CPU_SET( cpu, &set );
+    return pthread_setaffinity_np( pthread_self(), sizeof( set ), &set ) == 0;
+#else
+    return false;
+#endif
+}
+
+int cNuma::CurrentNode()
+{
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    if( cpu < 0 )
+        return -1;
+    for( int node : Nodes() )
+    {
+        for( int c : NodeCPUs( node ) )
+            if( c == cpu )
+                return node;
+    }
+#endif
+    return -1;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/** NUMA topology helpers
+
+    Read from sysfs so there is no dependency on libnuma.
+    On hosts without NUMA information everything reports a single node 0,
+    and on platforms other than linux the pinning calls do nothing.
+*/
+class cNuma
+{
+public:
+
+    /// online NUMA nodes, at least node 0
+    static std::vector< int > Nodes();
+
+    /// number of online NUMA nodes, at least 1
+    static int NodeCount();
+
+    /// CPUs belonging to node
+    static std::vector< int > NodeCPUs( int node );
+
+    /** Node a network interface is attached to
+        @param[in] ifname interface name, e.g. "eth0"
+        @return node, or -1 if unknown ( e.g. virtual interface )
+    */
+    static int NICNode( const std::string& ifname );
+
+    /** Interface a connected socket is using
+        @param[in] fd native handle of connected socket
+        @return interface name, or empty if unknown
+    */
+    static std::string SocketInterface( int fd );
+
+    /** Node nearest the NIC a connected socket is using
+        @param[in] fd native handle of connected socket
+        @return node, or -1 if unknown
+    */
+    static int SocketNode( int fd );
+
+    /** Pin calling thread to the CPUs of a node
+        @return true if successful
+    */
+    static bool PinThisThread( int node );
+
+    /// Node the calling thread is currently running on, or -1 if unknown
+    static int CurrentNode();
+
+private:
+
+    /// parse sysfs cpu or node list such as "0-3,8-11"
+    static std::vector< int > ParseCPUList( const std::string& list );
+};
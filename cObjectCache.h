@@ -0,0 +1,173 @@
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+/** Per-thread cache of storage for objects of type T
+
+    Allocate() constructs a T in storage taken from the calling thread's free list,
+    Free() destroys it and puts the storage back.
+    The free lists need no locks, so objects created and destroyed
+    at a high rate do not contend on the global allocator
+    and their memory stays hot in the cache of the thread using them.
+
+    An object freed by a thread other than the one that allocated it
+    is handed back to its owner through a mutex protected return list,
+    which the owner drains when its own free list runs dry.
+
+    Usage:
+
+        T * p = cObjectCache< T >::Allocate( ctor args );
+        ...
+        cObjectCache< T >::Free( p );
+*/
+template< class T >
+class cObjectCache
+{
+public:
+
+    /// maximum objects kept on each thread's free list, beyond this storage goes back to the heap
+    static const std::size_t MAX_CACHED = 256;
+
+    /** Construct object
+        @param[in] args passed to T's CTOR
+        @return pointer to new object
+    */
+    template< class... Args >
+    static T * Allocate( Args&&... args )
+    {
+        cThreadCache& local = Local();
+        sBlock * b = local.Pop();
+        if( ! b )
+            b = new sBlock;
+        b->myOwner = local.myReturn;
+        try
+        {
+            return new( &b->myStorage ) T( std::forward< Args >( args )... );
+        }
+        catch( ... )
+        {
+            local.Push( b );
+            throw;
+        }
+    }
+
+    /** Destroy object
+        @param[in] p object returned by Allocate(), may be 0
+
+        May be called from any thread
+    */
+    static void Free( T * p )
+    {
+        if( ! p )
+            return;
+        p->~T();
+
+        // storage is the first member of the block
+        sBlock * b = reinterpret_cast< sBlock * >( p );
+
+        cThreadCache& local = Local();
+        if( b->myOwner == local.myReturn )
+            local.Push( b );
+        else
+            b->myOwner->Return( b );
+    }
+
+    /// Number of objects on the calling thread's free list
+    static std::size_t Cached()
+    {
+        return Local().myFree.size();
+    }
+
+private:
+
+    struct sReturn;
+
+    struct sBlock
+    {
+        typename std::aligned_storage< sizeof( T ), alignof( T ) >::type myStorage;
+        sReturn * myOwner;
+    };
+
+    /** Return path to the thread that owns some storage
+
+        This outlives its thread, so storage freed after the owner has exited
+        still has somewhere to go.  It then goes back to the heap.
+    */
+    struct sReturn
+    {
+        std::mutex myMutex;
+        std::vector< sBlock * > myBlocks;
+        bool myfOrphan;
+
+        sReturn()
+            : myfOrphan( false )
+        {
+
+        }
+
+        void Return( sBlock * b )
+        {
+            std::lock_guard<std::mutex> lck (myMutex);
+            if( myfOrphan )
+                delete b;
+            else
+                myBlocks.push_back( b );
+        }
+    };
+
+    class cThreadCache
+    {
+    public:
+        std::vector< sBlock * > myFree;
+        sReturn * myReturn;
+
+        cThreadCache()
+            : myReturn( new sReturn )
+        {
+
+        }
+        ~cThreadCache()
+        {
+            for( sBlock * b : myFree )
+                delete b;
+            std::lock_guard<std::mutex> lck (myReturn->myMutex);
+            for( sBlock * b : myReturn->myBlocks )
+                delete b;
+            myReturn->myBlocks.clear();
+            myReturn->myfOrphan = true;
+        }
+
+        sBlock * Pop()
+        {
+            if( ! myFree.size() )
+            {
+                // collect storage freed by other threads
+                std::lock_guard<std::mutex> lck (myReturn->myMutex);
+                myFree.swap( myReturn->myBlocks );
+            }
+            if( ! myFree.size() )
+                return 0;
+            sBlock * b = myFree.back();
+            myFree.pop_back();
+            return b;
+        }
+
+        void Push( sBlock * b )
+        {
+            if( myFree.size() >= MAX_CACHED )
+                delete b;
+            else
+                myFree.push_back( b );
+        }
+    };
+
+    static cThreadCache& Local()
+    {
+        static thread_local cThreadCache theCache;
+        return theCache;
+    }
+};
@@ -0,0 +1,167 @@
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cerrno>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "cPerfCounters.h"
+
+namespace
+{
+thread_local cPerfCounters * theLocal = 0;
+
+const char * theStageNames[] =
+{
+    "read completion",
+    "decode",
+    "dispatch",
+    "write submit",
+    "FinishWork job"
+};
+}
+
+cPerfCounters::cPerfCounters()
+    : myLeader( -1 )
+    , mySkipped( 0 )
+    , myFrames( 0 )
+{
+    for( int k = 0; k < PERF_COUNTER_COUNT; k++ )
+        myFD[k] = -1;
+    memset( myTotals, 0, sizeof( myTotals ));
+    memset( myEvents, 0, sizeof( myEvents ));
+}
+
+cPerfCounters::~cPerfCounters()
+{
+#ifdef __linux__
+    for( int k = 0; k < PERF_COUNTER_COUNT; k++ )
+        if( myFD[k] >= 0 )
+            close( myFD[k] );
+#endif
+}
+
+cPerfCounters * cPerfCounters::Local()
+{
+    return theLocal;
+}
+
+bool cPerfCounters::Open()
+{
+#ifdef __linux__
+    if( theLocal )
+        return true;
+    static const unsigned long long config[ PERF_COUNTER_COUNT ] =
+    {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+    cPerfCounters * c = new cPerfCounters();
+    for( int k = 0; k < PERF_COUNTER_COUNT; k++ )
+    {
+        perf_event_attr attr;
+        memset( &attr, 0, sizeof( attr ));
+        attr.size = sizeof( attr );
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config[k];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP
+                           | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        // the group is scheduled onto the PMU together, so the four counts cover the same instructions
+        attr.disabled = k == 0;
+        c->myFD[k] = syscall( __NR_perf_event_open, &attr, 0, -1, c->myLeader, 0 );
+        if( c->myFD[k] < 0 )
+        {
+            std::cout << "Performance counters unavailable: " << strerror( errno ) << "\n";
+            delete c;
+            return false;
+        }
+        if( k == 0 )
+            c->myLeader = c->myFD[0];
+    }
+    ioctl( c->myLeader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+    theLocal = c;
+    return true;
+#else
+    std::cout << "Performance counters need linux\n";
+    return false;
+#endif
+}
+
+bool cPerfCounters::Read( unsigned long long * values )
+{
+#ifdef __linux__
+    // group read: number of counters, time enabled, time running, then their values
+    unsigned long long buf[ 3 + PERF_COUNTER_COUNT ];
+    if( read( myLeader, buf, sizeof( buf )) != sizeof( buf ))
+        return false;
+    for( int k = 0; k < PERF_COUNTER_COUNT; k++ )
+        values[k] = buf[ 3 + k ];
+    values[ PERF_COUNTER_COUNT ] = buf[1];
+    values[ PERF_COUNTER_COUNT + 1 ] = buf[2];
+    return true;
+#else
+    return false;
+#endif
+}
+
+void cPerfCounters::Charge(
+    stage s,
+    const unsigned long long * before,
+    const unsigned long long * after )
+{
+    unsigned long long enabled = after[ PERF_COUNTER_COUNT ] - before[ PERF_COUNTER_COUNT ];
+    unsigned long long running = after[ PERF_COUNTER_COUNT + 1 ] - before[ PERF_COUNTER_COUNT + 1 ];
+    if( ! running )
+    {
+        // the group was off the PMU for the whole stage, there is nothing to scale
+        mySkipped++;
+        return;
+    }
+    double scale = (double) enabled / running;
+    int i = (int) s;
+    for( int k = 0; k < PERF_COUNTER_COUNT; k++ )
+        myTotals[i][k] += (unsigned long long)( ( after[k] - before[k] ) * scale + 0.5 );
+    myEvents[i]++;
+}
+
+void cPerfCounters::Report()
+{
+    cPerfCounters * c = theLocal;
+    if( ! c )
+        return;
+    std::cout << c->myFrames << " frames read\n";
+    std::cout << "Per event averages      events     cycles  instructions   IPC  cache-miss  branch-miss"
+              "  cycles/frame\n";
+    for( int i = 0; i < (int)stage::count; i++ )
+    {
+        unsigned long long n = c->myEvents[i];
+        if( ! n )
+            continue;
+        const unsigned long long * t = c->myTotals[i];
+        std::cout << std::left << std::setw( 20 ) << theStageNames[i] << std::right
+                  << std::setw( 10 ) << n
+                  << std::setw( 11 ) << t[0] / n
+                  << std::setw( 14 ) << t[1] / n
+                  << std::setw( 6 ) << std::fixed << std::setprecision( 2 )
+                  << ( t[0] ? (double) t[1] / t[0] : 0.0 )
+                  << std::setw( 12 ) << std::setprecision( 1 ) << (double) t[2] / n
+                  << std::setw( 13 ) << (double) t[3] / n;
+        if( c->myFrames )
+            std::cout << std::setw( 14 ) << (double) t[0] / c->myFrames;
+        else
+            std::cout << std::setw( 14 ) << "-";
+        std::cout << "\n";
+    }
+    std::cout << std::defaultfloat;
+    if( c->mySkipped )
+        std::cout << c->mySkipped << " stages not counted, the counters unreadable or not running\n";
+}
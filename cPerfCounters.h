@@ -0,0 +1,142 @@
+#pragma once
+
+#include <string>
+
+// hardware events counted: cycles, instructions, cache misses, branch misses
+#define PERF_COUNTER_COUNT 4
+
+// values in a reading: the counts, then the time the group was enabled and the time it was running
+#define PERF_READ_VALUES ( PERF_COUNTER_COUNT + 2 )
+
+/** Hardware performance counters, charged to named stages of the frame pipeline
+
+    Open() starts the CPU's counters for the calling thread, the event manager.
+    Code in a stage is bracketed by a cPerfStage, which reads the counters
+    as it starts and ends and charges the difference to its stage.
+    Report() prints each stage's average per event, that is per time the stage ran,
+    and its cycles per frame read, the stage's total over the frames read while counting.
+
+    Only user space is counted, so the counters can be opened without privilege
+    where perf_event_paranoid allows, and the reads themselves cost little
+    beyond their system call.  A stage nested inside another is also counted
+    in the enclosing stage.
+
+    If Open() is not called, or fails, each cPerfStage costs a thread local lookup.
+
+    When more events are wanted than the PMU has counters, the kernel time slices the groups,
+    so each count is scaled up by the time the group was enabled over the time it was running.
+    A stage during which the counters could not be read, or never ran, is not charged.
+*/
+class cPerfCounters
+{
+public:
+
+    /// the stages
+    enum class stage : unsigned char
+    {
+        read,           /// frame header read completion, validation and payload read submission
+        decode,         /// frame payload completion, up to handing it over
+        dispatch,       /// frame handler or request response handler, and submission of the next frame read
+        write,          /// write submission
+        work,           /// simulated job completion
+        count           /// number of stages
+    };
+
+    /** Start counting for the calling thread
+        @return true if the counters are available
+    */
+    static bool Open();
+
+    /// Print per event and per frame averages of each stage for the calling thread
+    static void Report();
+
+    /// counters of the calling thread, 0 if not counting
+    static cPerfCounters * Local();
+
+    /** read current counts
+        @param[out] values PERF_READ_VALUES of them
+        @return true if read
+    */
+    bool Read( unsigned long long * values );
+
+    /// charge counts between two reads to stage, scaled up for any time the counters were not running
+    void Charge(
+        stage s,
+        const unsigned long long * before,
+        const unsigned long long * after );
+
+    /// a stage could not be counted
+    void Skip()
+    {
+        mySkipped++;
+    }
+
+    /// a frame has been read and dispatched
+    static void Frame()
+    {
+        cPerfCounters * c = Local();
+        if( c )
+            c->myFrames++;
+    }
+
+private:
+    int myLeader;                       /// fd of group leader, the cycle counter
+    int myFD[ PERF_COUNTER_COUNT ];
+    unsigned long long myTotals[ (int)stage::count ][ PERF_COUNTER_COUNT ];
+    unsigned long long myEvents[ (int)stage::count ];
+    unsigned long long mySkipped;       /// stages not charged, the counters unreadable or not running
+    unsigned long long myFrames;        /// frames read while counting
+
+    cPerfCounters();
+    ~cPerfCounters();
+};
+
+/** Count a stage from construction to destruction
+
+    Usage:
+
+        cPerfStage perf( cPerfCounters::stage::decode );
+        ...
+        perf.Next( cPerfCounters::stage::dispatch );
+        ...
+*/
+class cPerfStage
+{
+public:
+    cPerfStage( cPerfCounters::stage s )
+        : myCounters( cPerfCounters::Local() )
+        , myStage( s )
+        , myfStarted( false )
+    {
+        if( myCounters )
+            myfStarted = myCounters->Read( myStart );
+    }
+
+    ~cPerfStage()
+    {
+        Next( myStage );
+    }
+
+    /// end current stage and start another
+    void Next( cPerfCounters::stage s )
+    {
+        if( ! myCounters )
+            return;
+        unsigned long long now[ PERF_READ_VALUES ];
+        bool ok = myCounters->Read( now );
+        if( ok && myfStarted )
+            myCounters->Charge( myStage, myStart, now );
+        else
+            myCounters->Skip();
+        for( int k = 0; k < PERF_READ_VALUES; k++ )
+            myStart[k] = now[k];
+        myfStarted = ok;
+        myStage = s;
+    }
+
+private:
+    cPerfCounters * myCounters;
+    cPerfCounters::stage myStage;
+    unsigned long long myStart[ PERF_READ_VALUES ];
+    bool myfStarted;                    /// true if myStart was read
+};
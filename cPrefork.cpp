@@ -0,0 +1,241 @@
+#include <iostream>
+#include <csignal>
+#include <ctime>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#endif
+
+#include "cPrefork.h"
+
+// longest delay before restarting a worker that keeps failing
+#define PREFORK_MAX_BACKOFF_SECS 32
+
+// a worker that ran this long before failing is restarted at once
+#define PREFORK_HEALTHY_SECS 10
+
+void sWorkerMetrics::Clear()
+{
+    myBytesRead = 0;
+    myBytesWritten = 0;
+    myFramesRead = 0;
+    myFramesWritten = 0;
+    myConnections = 0;
+}
+
+#ifdef __linux__
+
+namespace
+{
+volatile std::sig_atomic_t theStop = 0;
+
+void OnStop( int )
+{
+    theStop = 1;
+}
+
+long long Seconds()
+{
+    timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec;
+}
+}
+
+cPrefork::cPrefork(
+    int worker_count,
+    worker_t worker )
+    : myWorkerCount( worker_count )
+    , myWorker( worker )
+    , myMetrics( 0 )
+    , myWorkers( worker_count )
+{
+    for( auto& r : myRetired )
+        r = 0;
+    // shared with the workers, which inherit the mapping when forked
+    void * p = mmap(
+                   0, worker_count * sizeof( sWorkerMetrics ),
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    if( p == MAP_FAILED )
+        throw std::runtime_error( "prefork metrics" );
+    myMetrics = new( p ) sWorkerMetrics[ worker_count ];
+    for( auto& w : myWorkers )
+    {
+        w.myPid = 0;
+        w.myRestarts = 0;
+        w.myBackoffSecs = 1;
+        w.myStarted = 0;
+        w.myRestartAt = 0;
+    }
+}
+
+cPrefork::~cPrefork()
+{
+    munmap( myMetrics, myWorkerCount * sizeof( sWorkerMetrics ));
+}
+
+void cPrefork::Start( int index )
+{
+    myMetrics[ index ].Clear();
+
+    // or the child inherits whatever is still buffered and prints it again
+    std::cout.flush();
+    pid_t pid = fork();
+    if( pid < 0 )
+    {
+        std::cout << "Prefork cannot start worker " << index << "\n";
+        myWorkers[ index ].myRestartAt = Seconds() + myWorkers[ index ].myBackoffSecs;
+        return;
+    }
+    if( pid == 0 )
+    {
+        // worker
+        signal( SIGINT, SIG_DFL );
+        signal( SIGTERM, SIG_DFL );
+        // do not outlive the supervisor
+        prctl( PR_SET_PDEATHSIG, SIGTERM );
+        int code = myWorker( index, myMetrics[ index ] );
+        std::cout.flush();
+        _exit( code );
+    }
+    myWorkers[ index ].myPid = pid;
+    myWorkers[ index ].myStarted = Seconds();
+    std::cout << "Prefork worker " << index << " started, pid " << pid << "\n";
+}
+
+int cPrefork::Run()
+{
+    signal( SIGINT, OnStop );
+    signal( SIGTERM, OnStop );
+
+    for( int k = 0; k < myWorkerCount; k++ )
+        Start( k );
+
+    while( ! theStop )
+    {
+        sleep( 1 );
+        Reap();
+        long long now = Seconds();
+        for( int k = 0; k < myWorkerCount; k++ )
+        {
+            sWorker& w = myWorkers[ k ];
+            if( ! w.myPid && now >= w.myRestartAt && ! theStop )
+            {
+                w.myRestarts++;
+                Start( k );
+            }
+        }
+        Print();
+    }
+
+    std::cout << "Prefork stopping workers\n";
+    for( auto& w : myWorkers )
+        if( w.myPid )
+            kill( w.myPid, SIGTERM );
+    for( auto& w : myWorkers )
+        if( w.myPid )
+            waitpid( w.myPid, 0, 0 );
+    return 0;
+}
+
+void cPrefork::Reap()
+{
+    int status;
+    pid_t pid;
+    while( ( pid = waitpid( -1, &status, WNOHANG )) > 0 )
+    {
+        for( int k = 0; k < myWorkerCount; k++ )
+        {
+            sWorker& w = myWorkers[ k ];
+            if( w.myPid != pid )
+                continue;
+            w.myPid = 0;
+
+            // keep what the worker did, its connections have gone
+            sWorkerMetrics& m = myMetrics[ k ];
+            myRetired[0] += m.myBytesRead;
+            myRetired[1] += m.myBytesWritten;
+            myRetired[2] += m.myFramesRead;
+            myRetired[3] += m.myFramesWritten;
+            m.Clear();
+
+            if( WIFSIGNALED( status ))
+                std::cout << "Prefork worker " << k << " killed by signal " << WTERMSIG( status ) << "\n";
+            else
+                std::cout << "Prefork worker " << k << " exited " << WEXITSTATUS( status ) << "\n";
+
+            // back off a worker that fails soon after starting, so a persistent fault does not spin
+            long long now = Seconds();
+            if( now - w.myStarted >= PREFORK_HEALTHY_SECS )
+                w.myBackoffSecs = 1;
+            else if( w.myBackoffSecs < PREFORK_MAX_BACKOFF_SECS )
+                w.myBackoffSecs *= 2;
+            w.myRestartAt = now + w.myBackoffSecs;
+            break;
+        }
+    }
+}
+
+#else
+
+cPrefork::cPrefork(
+    int worker_count,
+    worker_t worker )
+    : myWorkerCount( worker_count )
+    , myWorker( worker )
+    , myMetrics( 0 )
+{
+    for( auto& r : myRetired )
+        r = 0;
+}
+
+cPrefork::~cPrefork()
+{
+
+}
+
+void cPrefork::Start( int index )
+{
+
+}
+
+int cPrefork::Run()
+{
+    std::cout << "Prefork needs linux\n";
+    return 1;
+}
+
+void cPrefork::Reap()
+{
+
+}
+
+#endif
+
+void cPrefork::Print()
+{
+    unsigned long long bytes_read = myRetired[0];
+    unsigned long long bytes_written = myRetired[1];
+    unsigned long long frames_read = myRetired[2];
+    unsigned long long frames_written = myRetired[3];
+    int connections = 0, running = 0, restarts = 0;
+    for( int k = 0; k < myWorkerCount; k++ )
+    {
+        const sWorkerMetrics& m = myMetrics[ k ];
+        bytes_read += m.myBytesRead.load( std::memory_order_relaxed );
+        bytes_written += m.myBytesWritten.load( std::memory_order_relaxed );
+        frames_read += m.myFramesRead.load( std::memory_order_relaxed );
+        frames_written += m.myFramesWritten.load( std::memory_order_relaxed );
+        connections += m.myConnections.load( std::memory_order_relaxed );
+        if( myWorkers[ k ].myPid )
+            running++;
+        restarts += myWorkers[ k ].myRestarts;
+    }
+    std::cout << "Prefork " << running << "/" << myWorkerCount << " workers, "
+              << connections << " connections, "
+              << frames_read << " frames " << bytes_read << " bytes read, "
+              << frames_written << " frames " << bytes_written << " bytes written, "
+              << restarts << " restarts\n";
+}
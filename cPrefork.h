@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+
+#include "cNonBlockingTCPClient.h"
+
+/** Metrics a worker publishes to its supervisor
+
+    Each worker has its own, on its own cache lines, in memory shared with the supervisor.
+    The worker is the only writer, so there are no locks.
+*/
+struct alignas( CACHE_LINE_BYTES ) sWorkerMetrics
+{
+    std::atomic< unsigned long long > myBytesRead;
+    std::atomic< unsigned long long > myBytesWritten;
+    std::atomic< unsigned long long > myFramesRead;
+    std::atomic< unsigned long long > myFramesWritten;
+    std::atomic< int > myConnections;
+
+    /// zero all, the supervisor does this before starting a worker
+    void Clear();
+};
+
+/** Supervisor of prefork worker processes
+
+    Forks N workers, each running its own event manager over its own share of the connections.
+    Workers share nothing but their metrics, so they scale across cores without locks
+    and a crash takes down only the crashed worker's connections.
+
+    The supervisor prints the metrics summed over the workers every second,
+    including those of workers that have exited,
+    and restarts a worker that crashes or exits, after a delay that doubles
+    on each quick failure.
+*/
+class cPrefork
+{
+public:
+
+    /** Run worker
+        @param[in] worker index, 0 to worker_count - 1
+        @param[in] metrics to publish to
+        @return exit code of worker process
+    */
+    typedef std::function< int( int worker, sWorkerMetrics& metrics ) > worker_t;
+
+    /** CTOR
+        @param[in] worker_count number of worker processes
+        @param[in] worker run in each worker process
+    */
+    cPrefork(
+        int worker_count,
+        worker_t worker );
+
+    ~cPrefork();
+
+    /** Start workers and supervise them
+        @return exit code
+
+        Returns when the supervisor is sent SIGINT or SIGTERM, after stopping the workers
+    */
+    int Run();
+
+private:
+
+    /// state of one worker, kept by the supervisor
+    struct sWorker
+    {
+        int myPid;                      /// 0 while waiting to be restarted
+        int myRestarts;
+        int myBackoffSecs;              /// delay before next restart
+        long long myStarted;            /// time started, seconds
+        long long myRestartAt;          /// time to restart, seconds
+    };
+
+    int myWorkerCount;
+    worker_t myWorker;
+    sWorkerMetrics * myMetrics;         /// one per worker, in shared memory
+    std::vector< sWorker > myWorkers;
+    unsigned long long myRetired[4];    /// bytes and frames read and written by workers that have exited
+
+    void Start( int index );
+
+    /// collect exited workers and schedule their restart
+    void Reap();
+
+    void Print();
+};
@@ -0,0 +1,289 @@
+#include <algorithm>
+
+#include "cResponseCache.h"
+#include "cClock.h"
+
+cResponseCache::cResponseCache(
+    cSingleFlight& flight,
+    std::size_t max_bytes )
+    : myFlight( flight )
+    , myShardBytes( max_bytes / RESPONSE_CACHE_SHARDS )
+    , myHits( 0 )
+    , myStaleHits( 0 )
+    , myMisses( 0 )
+    , myEvictions( 0 )
+{
+
+}
+
+std::uint64_t cResponseCache::Now()
+{
+    // the event manager's clock, so that in virtual time entries expire in simulated time
+    static const boost::posix_time::ptime epoch( boost::gregorian::date( 1970, 1, 1 ));
+    return ( cClock::Now() - epoch ).total_milliseconds();
+}
+
+std::uint64_t cResponseCache::Key(
+    int type,
+    const unsigned char * payload,
+    std::size_t length )
+{
+    return cSingleFlight::Hash( payload, length ) ^ ( (std::uint64_t)type << 48 );
+}
+
+void cResponseCache::TTL(
+    int type,
+    int fresh_msecs,
+    int stale_msecs )
+{
+    sTTL& ttl = myTTL[ type ];
+    ttl.myFresh = fresh_msecs;
+    ttl.myStale = stale_msecs;
+}
+
+std::size_t cResponseCache::Bytes()
+{
+    std::size_t total = 0;
+    for( sShard& shard : myShards )
+    {
+        std::lock_guard<std::mutex> lck (shard.myMutex);
+        total += shard.myBytes;
+    }
+    return total;
+}
+
+int cResponseCache::Find(
+    sShard& shard,
+    std::uint64_t key,
+    int type,
+    const unsigned char * payload,
+    std::size_t length )
+{
+    auto range = shard.myIndex.equal_range( key );
+    for( auto it = range.first; it != range.second; it++ )
+    {
+        sEntry& e = shard.mySlots[ it->second ];
+        if( e.myType == type
+                && e.myKey.size() == length
+                && std::equal( payload, payload + length, e.myKey.begin() ))
+            return (int) it->second;
+    }
+    return -1;
+}
+
+bool cResponseCache::Lookup(
+    int type,
+    const unsigned char * payload,
+    std::size_t length,
+    int& response_type,
+    std::vector< unsigned char >& response )
+{
+    if( myTTL.find( type ) == myTTL.end() )
+        return false;
+    std::uint64_t key = Key( type, payload, length );
+    sShard& shard = myShards[ key % RESPONSE_CACHE_SHARDS ];
+    std::lock_guard<std::mutex> lck (shard.myMutex);
+    int slot = Find( shard, key, type, payload, length );
+    if( slot < 0 || shard.mySlots[ slot ].myFresh <= Now() )
+        return false;
+    sEntry& e = shard.mySlots[ slot ];
+    e.myfReferenced = true;
+    response_type = e.myResponseType;
+    response = e.myResponse;
+    myHits++;
+    return true;
+}
+
+void cResponseCache::Request(
+    int type,
+    const unsigned char * payload,
+    std::size_t length,
+    cNonBlockingTCPClient::response_t response )
+{
+    if( myTTL.find( type ) == myTTL.end() )
+    {
+        // not a cacheable type
+        myMisses++;
+        myFlight.Request( type, payload, length, response );
+        return;
+    }
+
+    std::uint64_t key = Key( type, payload, length );
+    sShard& shard = myShards[ key % RESPONSE_CACHE_SHARDS ];
+    std::uint64_t now = Now();
+
+    bool hit = false;
+    bool refresh = false;
+    int response_type = 0;
+    std::vector< unsigned char > cached;
+    {
+        std::lock_guard<std::mutex> lck (shard.myMutex);
+        int slot = Find( shard, key, type, payload, length );
+        if( slot >= 0 && shard.mySlots[ slot ].myStale <= now )
+        {
+            // too old to serve
+            Evict( shard, slot );
+            slot = -1;
+        }
+        if( slot < 0 )
+        {
+            myMisses++;
+        }
+        else
+        {
+            sEntry& e = shard.mySlots[ slot ];
+            e.myfReferenced = true;
+            hit = true;
+            response_type = e.myResponseType;
+            cached = e.myResponse;
+            if( e.myFresh > now )
+                myHits++;
+            else
+            {
+                myStaleHits++;
+                if( ! e.myfRefreshing )
+                {
+                    e.myfRefreshing = true;
+                    refresh = true;
+                }
+            }
+        }
+    }
+
+    if( ! hit )
+    {
+        Fetch( type, payload, length, response );
+        return;
+    }
+
+    // serve from cache, copied out so the shard is not locked while the caller runs
+    if( refresh )
+        Fetch( type, payload, length,
+               []( bool, int, const std::vector< unsigned char >& ) {} );
+    response( true, response_type, cached );
+}
+
+void cResponseCache::Fetch(
+    int type,
+    const unsigned char * payload,
+    std::size_t length,
+    cNonBlockingTCPClient::response_t response )
+{
+    std::vector< unsigned char > request( payload, payload + length );
+    myFlight.Request(
+        type, payload, length,
+        [this, type, request, response]
+        ( bool ok, int response_type, const std::vector< unsigned char >& reply )
+    {
+        if( ok )
+            Store( type, request, response_type, reply );
+        else
+        {
+            // let a later stale hit try again
+            std::uint64_t key = Key( type, request.data(), request.size() );
+            sShard& shard = myShards[ key % RESPONSE_CACHE_SHARDS ];
+            std::lock_guard<std::mutex> lck (shard.myMutex);
+            int slot = Find( shard, key, type, request.data(), request.size() );
+            if( slot >= 0 )
+                shard.mySlots[ slot ].myfRefreshing = false;
+        }
+        response( ok, response_type, reply );
+    });
+}
+
+void cResponseCache::Store(
+    int type,
+    const std::vector< unsigned char >& payload,
+    int response_type,
+    const std::vector< unsigned char >& response )
+{
+    const sTTL& ttl = myTTL[ type ];
+    std::uint64_t key = Key( type, payload.data(), payload.size() );
+    sShard& shard = myShards[ key % RESPONSE_CACHE_SHARDS ];
+    std::uint64_t now = Now();
+
+    std::lock_guard<std::mutex> lck (shard.myMutex);
+
+    // replace any previous response
+    int slot = Find( shard, key, type, payload.data(), payload.size() );
+    if( slot >= 0 )
+        Evict( shard, slot );
+
+    if( ! MakeRoom( shard, payload.size() + response.size() ))
+        return;
+
+    if( shard.myFree.size() )
+    {
+        slot = shard.myFree.back();
+        shard.myFree.pop_back();
+    }
+    else
+    {
+        slot = shard.mySlots.size();
+        shard.mySlots.push_back( sEntry() );
+    }
+    sEntry& e = shard.mySlots[ slot ];
+    e.myType = type;
+    e.myKey = payload;
+    e.myResponseType = response_type;
+    e.myResponse = response;
+    e.myFresh = now + ttl.myFresh;
+    e.myStale = e.myFresh + ttl.myStale;
+    e.myfUsed = true;
+    e.myfReferenced = false;
+    e.myfRefreshing = false;
+    shard.myIndex.insert( std::make_pair( key, (std::size_t) slot ));
+    shard.myBytes += e.Bytes();
+}
+
+bool cResponseCache::MakeRoom(
+    sShard& shard,
+    std::size_t bytes )
+{
+    if( bytes > myShardBytes )
+        return false;
+
+    // two sweeps of the hand clear every referenced bit, so this always ends
+    std::size_t count = shard.mySlots.size();
+    for( std::size_t k = 0;
+            k < 2 * count && shard.myBytes + bytes > myShardBytes;
+            k++ )
+    {
+        std::size_t slot = shard.myHand;
+        shard.myHand = ( shard.myHand + 1 ) % count;
+        sEntry& e = shard.mySlots[ slot ];
+        if( ! e.myfUsed )
+            continue;
+        if( e.myfReferenced )
+        {
+            // second chance
+            e.myfReferenced = false;
+            continue;
+        }
+        Evict( shard, slot );
+        myEvictions++;
+    }
+    return shard.myBytes + bytes <= myShardBytes;
+}
+
+void cResponseCache::Evict(
+    sShard& shard,
+    std::size_t slot )
+{
+    sEntry& e = shard.mySlots[ slot ];
+    std::uint64_t key = Key( e.myType, e.myKey.data(), e.myKey.size() );
+    auto range = shard.myIndex.equal_range( key );
+    for( auto it = range.first; it != range.second; it++ )
+    {
+        if( it->second == slot )
+        {
+            shard.myIndex.erase( it );
+            break;
+        }
+    }
+    shard.myBytes -= e.Bytes();
+    e.myfUsed = false;
+    std::vector< unsigned char >().swap( e.myKey );
+    std::vector< unsigned char >().swap( e.myResponse );
+    shard.myFree.push_back( slot );
+}
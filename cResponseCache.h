@@ -0,0 +1,208 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+#include <atomic>
+
+#include "cSingleFlight.h"
+
+/// number of independently locked parts of the cache
+#define RESPONSE_CACHE_SHARDS 16
+
+/** Cache of responses to idempotent requests
+
+    Responses are cached keyed by the request's payload type and payload,
+    for a time set per payload type.  Types without a time set are never cached.
+    A request answered from the cache makes no round trip to the server.
+
+    Once its time is up an entry may still be served, stale, for a further period
+    while a refresh is requested in the background, so callers do not wait
+    for the server every time an entry expires.
+
+    The entries are split across shards, each with its own lock,
+    so lookups from several threads rarely contend.
+    Each shard keeps to an equal part of the memory cap,
+    evicting with the CLOCK algorithm: entries hit since the hand last passed
+    are given a second chance, the first entry found not hit is evicted.
+
+    Requests that miss go to the server through a cSingleFlight,
+    so a burst of misses on one key costs one request.
+    Request() may therefore only be called from the event manager thread,
+    Lookup() from any thread.
+*/
+class cResponseCache
+{
+public:
+
+    /** CTOR
+        @param[in] flight layer misses and refreshes are requested through
+        @param[in] max_bytes cap on memory used by cached keys and responses
+    */
+    cResponseCache(
+        cSingleFlight& flight,
+        std::size_t max_bytes );
+
+    /** Cache responses to requests of a payload type
+        @param[in] type payload type of request
+        @param[in] fresh_msecs time a response is served without asking the server
+        @param[in] stale_msecs further time a response is served while it is refreshed
+
+        Call before requests are made.
+    */
+    void TTL(
+        int type,
+        int fresh_msecs,
+        int stale_msecs = 0 );
+
+    /** Request, answering from the cache where possible
+        @param[in] type payload type
+        @param[in] payload
+        @param[in] length of payload
+        @param[in] response called with the response
+
+        On a hit the response is called before this returns.
+    */
+    void Request(
+        int type,
+        const unsigned char * payload,
+        std::size_t length,
+        cNonBlockingTCPClient::response_t response );
+
+    /** Look up a fresh response, without asking the server
+        @param[in] type payload type
+        @param[in] payload
+        @param[in] length of payload
+        @param[out] response_type payload type of response
+        @param[out] response payload of response
+        @return true if a fresh response was cached
+
+        May be called from any thread
+    */
+    bool Lookup(
+        int type,
+        const unsigned char * payload,
+        std::size_t length,
+        int& response_type,
+        std::vector< unsigned char >& response );
+
+    /// Requests answered from cache with a fresh response
+    unsigned long long Hits() const
+    {
+        return myHits;
+    }
+
+    /// Requests answered from cache with a stale response
+    unsigned long long StaleHits() const
+    {
+        return myStaleHits;
+    }
+
+    /// Requests that went to the server
+    unsigned long long Misses() const
+    {
+        return myMisses;
+    }
+
+    /// Entries evicted to stay under the memory cap
+    unsigned long long Evictions() const
+    {
+        return myEvictions;
+    }
+
+    /// Bytes used by cached keys and responses
+    std::size_t Bytes();
+
+private:
+
+    struct sEntry
+    {
+        int myType;
+        std::vector< unsigned char > myKey;         /// request payload
+        int myResponseType;
+        std::vector< unsigned char > myResponse;    /// response payload
+        std::uint64_t myFresh;                      /// served without refresh until
+        std::uint64_t myStale;                      /// served at all until
+        bool myfUsed;                               /// slot holds an entry
+        bool myfReferenced;                         /// hit since the clock hand passed
+        bool myfRefreshing;                         /// refresh requested and not yet answered
+
+        std::size_t Bytes() const
+        {
+            return myKey.size() + myResponse.size();
+        }
+    };
+
+    struct sShard
+    {
+        std::mutex myMutex;
+        std::unordered_multimap< std::uint64_t, std::size_t > myIndex;  /// hash to slot
+        std::vector< sEntry > mySlots;
+        std::vector< std::size_t > myFree;                              /// unused slots
+        std::size_t myHand;                                             /// clock hand
+        std::size_t myBytes;
+
+        sShard()
+            : myHand( 0 )
+            , myBytes( 0 )
+        {
+
+        }
+    };
+
+    struct sTTL
+    {
+        int myFresh;
+        int myStale;
+    };
+
+    cSingleFlight& myFlight;
+    std::size_t myShardBytes;                       /// memory cap of each shard
+    std::map< int, sTTL > myTTL;
+    sShard myShards[ RESPONSE_CACHE_SHARDS ];
+    std::atomic< unsigned long long > myHits;
+    std::atomic< unsigned long long > myStaleHits;
+    std::atomic< unsigned long long > myMisses;
+    std::atomic< unsigned long long > myEvictions;
+
+    /// msecs on cClock, real or virtual
+    static std::uint64_t Now();
+
+    static std::uint64_t Key(
+        int type,
+        const unsigned char * payload,
+        std::size_t length );
+
+    /// find entry, -1 if not cached.  Shard must be locked
+    int Find(
+        sShard& shard,
+        std::uint64_t key,
+        int type,
+        const unsigned char * payload,
+        std::size_t length );
+
+    /// ask server, caching the response
+    void Fetch(
+        int type,
+        const unsigned char * payload,
+        std::size_t length,
+        cNonBlockingTCPClient::response_t response );
+
+    /// store response from server
+    void Store(
+        int type,
+        const std::vector< unsigned char >& payload,
+        int response_type,
+        const std::vector< unsigned char >& response );
+
+    /// evict entries until bytes will fit.  Shard must be locked
+    bool MakeRoom(
+        sShard& shard,
+        std::size_t bytes );
+
+    void Evict(
+        sShard& shard,
+        std::size_t slot );
+};
@@ -0,0 +1,79 @@
+#include <algorithm>
+
+#include "cSingleFlight.h"
+#include "cObjectCache.h"
+
+std::uint64_t cSingleFlight::Hash(
+    const unsigned char * payload,
+    std::size_t length )
+{
+    std::uint64_t h = 14695981039346656037ULL;
+    for( std::size_t k = 0; k < length; k++ )
+    {
+        h ^= payload[k];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+void cSingleFlight::Request(
+    int type,
+    const unsigned char * payload,
+    std::size_t length,
+    cNonBlockingTCPClient::response_t response )
+{
+    std::uint64_t key = Hash( payload, length ) ^ ( (std::uint64_t)type << 48 );
+
+    // join an identical request in flight
+    auto range = myFlights.equal_range( key );
+    for( auto it = range.first; it != range.second; it++ )
+    {
+        sFlight * f = it->second;
+        if( f->myType == type
+                && f->myPayload.size() == length
+                && std::equal( payload, payload + length, f->myPayload.begin() ))
+        {
+            f->myWaiters.push_back( response );
+            myCoalesced++;
+            return;
+        }
+    }
+
+    // a flight per distinct request, so its storage comes from the thread's cache
+    sFlight * f = cObjectCache< sFlight >::Allocate();
+    f->myType = type;
+    f->myPayload.assign( payload, payload + length );
+    f->myWaiters.push_back( response );
+    myFlights.insert( std::make_pair( key, f ));
+    mySent++;
+
+    std::vector< boost::asio::const_buffer > parts;
+    parts.push_back( boost::asio::buffer( f->myPayload ));
+    myClient.Request(
+        EncodeFrame( type, parts ),
+        std::bind( &cSingleFlight::handle_response, this, key, f,
+                   std::placeholders::_1, std::placeholders::_2, std::placeholders::_3 ));
+}
+
+void cSingleFlight::handle_response(
+    std::uint64_t key,
+    sFlight * flight,
+    bool ok,
+    int type,
+    const std::vector< unsigned char >& payload )
+{
+    // the flight is over, requests from now on go to the server
+    auto range = myFlights.equal_range( key );
+    for( auto it = range.first; it != range.second; it++ )
+    {
+        if( it->second == flight )
+        {
+            myFlights.erase( it );
+            break;
+        }
+    }
+
+    for( auto& waiter : flight->myWaiters )
+        waiter( ok, type, payload );
+    cObjectCache< sFlight >::Free( flight );
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+#include "cNonBlockingTCPClient.h"
+
+/** Merge identical requests that are in flight at the same time
+
+    A request with the same payload type and payload as one already waiting
+    for its response is not sent again.
+    Its caller joins the waiters, and the one response is passed to all of them.
+    A burst of identical requests costs the server one request.
+
+    Use from the event manager thread.
+*/
+class cSingleFlight
+{
+public:
+
+    /** CTOR
+        @param[in] client connection requests are sent on
+    */
+    cSingleFlight( cNonBlockingTCPClient& client )
+        : myClient( client )
+        , mySent( 0 )
+        , myCoalesced( 0 )
+    {
+
+    }
+
+    /** Send request, unless an identical one is in flight
+        @param[in] type payload type
+        @param[in] payload
+        @param[in] length of payload
+        @param[in] response called with the response
+    */
+    void Request(
+        int type,
+        const unsigned char * payload,
+        std::size_t length,
+        cNonBlockingTCPClient::response_t response );
+
+    /// Number of requests sent to the server
+    unsigned long long Sent() const
+    {
+        return mySent;
+    }
+
+    /// Number of requests answered by joining one in flight
+    unsigned long long Coalesced() const
+    {
+        return myCoalesced;
+    }
+
+    /// FNV-1a hash of payload
+    static std::uint64_t Hash(
+        const unsigned char * payload,
+        std::size_t length );
+
+private:
+
+    /// a request in flight and everyone waiting for its response
+    struct sFlight
+    {
+        int myType;
+        std::vector< unsigned char > myPayload;
+        std::vector< cNonBlockingTCPClient::response_t > myWaiters;
+    };
+
+    cNonBlockingTCPClient& myClient;
+    std::unordered_multimap< std::uint64_t, sFlight * > myFlights;  /// keyed by hash of type and payload
+    unsigned long long mySent;
+    unsigned long long myCoalesced;
+
+    void handle_response(
+        std::uint64_t key,
+        sFlight * flight,
+        bool ok,
+        int type,
+        const std::vector< unsigned char >& payload );
+};
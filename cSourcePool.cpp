@@ -0,0 +1,132 @@
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#ifdef __linux__
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
+#include "cSourcePool.h"
+
+cSourcePool::cSourcePool()
+    : myNext( 0 )
+    , myFirstPort( 0 )
+    , myLastPort( 0 )
+    , myBinds( 0 )
+    , myCollisions( 0 )
+{
+
+}
+
+bool cSourcePool::Add( const std::string& ip )
+{
+    boost::system::error_code ec;
+    boost::asio::ip::address address = boost::asio::ip::make_address( ip, ec );
+    if( ec )
+    {
+        std::cout << "Invalid source address " << ip << "\n";
+        return false;
+    }
+    myAddress.push_back( address );
+    myNextPort.push_back( myFirstPort );
+    return true;
+}
+
+bool cSourcePool::AddList( const std::string& ips )
+{
+    std::stringstream ss( ips );
+    std::string ip;
+    bool ok = true;
+    while( std::getline( ss, ip, ',' ))
+        if( ip.length() )
+            ok = Add( ip ) && ok;
+    return ok;
+}
+
+void cSourcePool::PortRange(
+    unsigned short first,
+    unsigned short last )
+{
+    myFirstPort = first;
+    myLastPort = last < first ? first : last;
+    for( auto& p : myNextPort )
+        p = myFirstPort;
+}
+
+void cSourcePool::Slice(
+    int index,
+    int count )
+{
+    int ports = myFirstPort ? myLastPort - myFirstPort + 1 : 0;
+    if( count < 2 || ports < count || index < 0 || index >= count )
+        return;
+    int share = ports / count;
+    unsigned short first = myFirstPort + index * share;
+    unsigned short last = index == count - 1 ? myLastPort : first + share - 1;
+    PortRange( first, last );
+}
+
+int cSourcePool::Bind(
+    int fd,
+    const boost::asio::ip::tcp::endpoint& server )
+{
+#ifdef __linux__
+    // next address of the server's family
+    std::size_t k = 0;
+    for( ; k < myAddress.size(); k++ )
+    {
+        std::size_t i = ( myNext + k ) % myAddress.size();
+        if( myAddress[i].is_v4() == server.address().is_v4() )
+            break;
+    }
+    if( k == myAddress.size() )
+    {
+        std::cout << "No source address of the server's family\n";
+        return EAFNOSUPPORT;
+    }
+    std::size_t i = ( myNext + k ) % myAddress.size();
+    myNext = i + 1;
+
+    unsigned short port = 0;
+    int one = 1;
+    if( myFirstPort )
+    {
+        // the same port may be in use to other destinations
+        port = myNextPort[i];
+        myNextPort[i] = port == myLastPort ? myFirstPort : port + 1;
+        setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one ));
+    }
+    else
+    {
+        // choose the port at connect, when the destination is known
+        setsockopt( fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof( one ));
+    }
+
+    boost::asio::ip::tcp::endpoint source( myAddress[i], port );
+    if( bind( fd, source.data(), source.size() ))
+    {
+        int error = errno;
+        if( error == EADDRINUSE )
+            myCollisions++;
+        else
+            std::cout << "Cannot bind to source " << source << ": " << strerror( error ) << "\n";
+        return error;
+    }
+    myBinds++;
+    return 0;
+#else
+    return EAFNOSUPPORT;
+#endif
+}
+
+bool cSourcePool::Failed( int error )
+{
+    // the four tuple is already in use
+    if( error == EADDRNOTAVAIL || error == EADDRINUSE )
+    {
+        myCollisions++;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+
+// connection attempts with different source ports before giving up
+#define SOURCE_BIND_ATTEMPTS 16
+
+/** Local addresses, and optionally ports, that outbound connections are bound to
+
+    A connection is identified by source address and port, and destination address and port,
+    so with one source address at most one connection per ephemeral port, about 28,000,
+    can be open to any one server.  Spreading connections over several source addresses
+    multiplies that.
+
+    By default each connection is bound to the next source address with IP_BIND_ADDRESS_NO_PORT,
+    which leaves the kernel to choose the port when the connection is made,
+    knowing the destination.  A port is then reused for different destinations
+    and different source addresses, rather than being reserved by the bind.
+
+    With a port range, ports are taken in turn from the range instead.
+    A port shared with a connection to the same destination is a collision:
+    the connect fails, it is counted, and the caller tries the next port.
+
+    Not thread safe, use from the event manager thread.
+*/
+class cSourcePool
+{
+public:
+
+    cSourcePool();
+
+    /** Add a local address to spread connections over
+        @param[in] ip address, must be configured on this host
+        @return true if the address is valid
+    */
+    bool Add( const std::string& ip );
+
+    /** Add comma separated addresses
+        @param[in] ips e.g. "10.0.0.1,10.0.0.2"
+        @return true if all are valid
+    */
+    bool AddList( const std::string& ips );
+
+    /** Take source ports from a range rather than leaving the kernel to choose them
+        @param[in] first port
+        @param[in] last port
+    */
+    void PortRange(
+        unsigned short first,
+        unsigned short last );
+
+    /** Keep only one slice of the port range, so processes sharing the range do not collide
+        @param[in] index of this process, from 0
+        @param[in] count of processes sharing the range
+
+        The range is split into count equal slices, any remainder going to the last.
+        Without a port range, or with more processes than ports, nothing changes.
+    */
+    void Slice(
+        int index,
+        int count );
+
+    /// true if no address has been added
+    bool Empty() const
+    {
+        return ! myAddress.size();
+    }
+
+    /** Bind socket to the next source
+        @param[in] fd socket, not yet connected
+        @param[in] server the socket is to connect to, only its address family is used
+        @return 0 if bound, EADDRINUSE if the source port is taken and the next is worth trying,
+            EAFNOSUPPORT if no source address is of the server's family, otherwise errno of the bind
+    */
+    int Bind(
+        int fd,
+        const boost::asio::ip::tcp::endpoint& server );
+
+    /** The connect after a Bind() failed
+        @param[in] error errno from connect
+        @return true if the failure was a source port collision, worth retrying with another
+    */
+    bool Failed( int error );
+
+    /// connections bound
+    unsigned long long Binds() const
+    {
+        return myBinds;
+    }
+
+    /// source ports found in use by a connection to the same destination
+    unsigned long long Collisions() const
+    {
+        return myCollisions;
+    }
+
+private:
+    std::vector< boost::asio::ip::address > myAddress;
+    std::size_t myNext;                 /// address for next bind
+    unsigned short myFirstPort;         /// port range, 0 to leave the kernel to choose
+    unsigned short myLastPort;
+    std::vector< unsigned short > myNextPort;   /// next port in range, for each address
+    unsigned long long myBinds;
+    unsigned long long myCollisions;
+};
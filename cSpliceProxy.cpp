@@ -0,0 +1,317 @@
+#include <iostream>
+#include <boost/bind.hpp>
+#ifdef __linux__
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#include "cSpliceProxy.h"
+#include "frame.h"
+
+cSpliceProxy::sPair::sPair( boost::asio::io_service& io_service )
+    : myDown( io_service )
+    , myUp( io_service )
+    , myfClosed( false )
+{
+    for( int k = 0; k < 2; k++ )
+    {
+        sDirection& d = myDir[k];
+        d.myPipe[0] = d.myPipe[1] = -1;
+        d.myInPipe = 0;
+        d.myfMore = false;
+        d.myBytes = 0;
+        d.myChunks = 0;
+        d.myfEnded = false;
+#ifdef __linux__
+        if( pipe2( d.myPipe, O_NONBLOCK | O_CLOEXEC ) )
+            d.myPipe[0] = d.myPipe[1] = -1;
+        else
+            fcntl( d.myPipe[1], F_SETPIPE_SZ, SPLICE_CHUNK_BYTES );
+#else
+        d.myBuffer.resize( SPLICE_CHUNK_BYTES );
+#endif
+    }
+    myDir[0].myFrom = &myDown;
+    myDir[0].myTo = &myUp;
+    myDir[0].myName = "client to server";
+    myDir[1].myFrom = &myUp;
+    myDir[1].myTo = &myDown;
+    myDir[1].myName = "server to client";
+}
+
+cSpliceProxy::sPair::~sPair()
+{
+#ifdef __linux__
+    for( int k = 0; k < 2; k++ )
+    {
+        if( myDir[k].myPipe[0] >= 0 )
+            close( myDir[k].myPipe[0] );
+        if( myDir[k].myPipe[1] >= 0 )
+            close( myDir[k].myPipe[1] );
+    }
+#endif
+}
+
+cSpliceProxy::cSpliceProxy(
+    boost::asio::io_service& io_service,
+    int listen_port,
+    const std::string& host,
+    const std::string& port,
+    int sample_every )
+    : myIOService( io_service )
+    , myAcceptor(
+          io_service,
+          boost::asio::ip::tcp::endpoint( boost::asio::ip::tcp::v4(), listen_port ))
+    , myHost( host )
+    , myPort( port )
+    , mySampleEvery( sample_every )
+    , myResolver( io_service )
+    , myRetryTimer( io_service )
+{
+#ifdef __linux__
+    // splice() into a socket the peer has reset raises SIGPIPE, and has no flag to prevent it
+    signal( SIGPIPE, SIG_IGN );
+#endif
+    std::cout << "Proxy listening on " << listen_port
+              << " relaying to " << host << ":" << port << "\n";
+    Accept();
+}
+
+void cSpliceProxy::Accept()
+{
+    myPending.reset( new sPair( myIOService ));
+    myAcceptor.async_accept(
+        myPending->myDown,
+        boost::bind(&cSpliceProxy::handle_accept, this,
+                    boost::asio::placeholders::error ));
+}
+
+void cSpliceProxy::handle_accept( const boost::system::error_code& error )
+{
+    if( error == boost::asio::error::operation_aborted )
+        return;
+    if( error )
+    {
+        // the pending connection stays queued, so wait rather than fail again at once
+        std::cout << "Proxy accept failed: " << error.message() << "\n";
+        myRetryTimer.expires_from_now( boost::posix_time::milliseconds( PROXY_ACCEPT_RETRY_MSECS ));
+        myRetryTimer.async_wait( [this]( const boost::system::error_code& error )
+        {
+            if( ! error )
+                Accept();
+        });
+        return;
+    }
+    std::shared_ptr< sPair > pair = myPending;
+    Accept();
+
+    // connect upstream without blocking, so the pairs already relayed keep moving
+    boost::asio::ip::tcp::resolver::query query( myHost, myPort );
+    myResolver.async_resolve(
+        query,
+        [this, pair]( const boost::system::error_code& error,
+                      boost::asio::ip::tcp::resolver::iterator it )
+    {
+        if( error )
+        {
+            handle_connect( pair, error );
+            return;
+        }
+        boost::asio::async_connect(
+            pair->myUp,
+            it,
+            [this, pair]( const boost::system::error_code& error,
+                          boost::asio::ip::tcp::resolver::iterator )
+        {
+            handle_connect( pair, error );
+        });
+    });
+}
+
+void cSpliceProxy::handle_connect(
+    std::shared_ptr< sPair > pair,
+    const boost::system::error_code& error )
+{
+    if( error )
+    {
+        std::cout << "Proxy upstream connection failed: " << error.message() << "\n";
+        return;
+    }
+    std::cout << "Proxy relaying new connection\n";
+
+    pair->myDown.set_option( boost::asio::ip::tcp::no_delay( true ));
+    pair->myUp.set_option( boost::asio::ip::tcp::no_delay( true ));
+    pair->myDown.native_non_blocking( true );
+    pair->myUp.native_non_blocking( true );
+
+    Relay( pair, 0 );
+    Relay( pair, 1 );
+}
+
+void cSpliceProxy::Relay(
+    std::shared_ptr< sPair > pair,
+    int dir )
+{
+    if( pair->myfClosed || pair->myDir[ dir ].myfEnded )
+        return;
+    sDirection& d = pair->myDir[ dir ];
+
+#ifdef __linux__
+    int from = d.myFrom->native_handle();
+    int to = d.myTo->native_handle();
+    while( 1 )
+    {
+        // drain the pipe into the destination socket
+        // holding back a partial segment only while more is known to follow, or a short exchange stalls
+        while( d.myInPipe )
+        {
+            ssize_t n = splice(
+                            d.myPipe[0], 0, to, 0, d.myInPipe,
+                            SPLICE_F_MOVE | SPLICE_F_NONBLOCK | ( d.myfMore ? SPLICE_F_MORE : 0 ));
+            if( n < 0 && errno == EAGAIN )
+            {
+                // destination full, wait until it can be written
+                d.myTo->async_write_some(
+                    boost::asio::null_buffers(),
+                    [this, pair, dir]( const boost::system::error_code& error, std::size_t )
+                {
+                    if( error )
+                        Close( *pair );
+                    else
+                        Relay( pair, dir );
+                });
+                return;
+            }
+            if( n <= 0 )
+            {
+                Close( *pair );
+                return;
+            }
+            d.myInPipe -= n;
+        }
+
+        // fill the pipe from the source socket
+        ssize_t n = splice(
+                        from, 0, d.myPipe[1], 0, SPLICE_CHUNK_BYTES,
+                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+        if( n < 0 && errno == EAGAIN )
+            break;
+        if( n == 0 )
+        {
+            // end of stream, and the pipe is empty
+            End( *pair, dir );
+            return;
+        }
+        if( n < 0 )
+        {
+            Close( *pair );
+            return;
+        }
+        d.myInPipe = n;
+        d.myfMore = n == SPLICE_CHUNK_BYTES;
+        d.myBytes += n;
+        d.myChunks++;
+        if( mySampleEvery && d.myChunks % mySampleEvery == 0 )
+            Inspect( d );
+    }
+
+    // wait for more bytes from the source
+    d.myFrom->async_read_some(
+        boost::asio::null_buffers(),
+        [this, pair, dir]( const boost::system::error_code& error, std::size_t )
+    {
+        if( error )
+            Close( *pair );
+        else
+            Relay( pair, dir );
+    });
+#else
+    d.myFrom->async_read_some(
+        boost::asio::buffer( d.myBuffer ),
+        [this, pair, dir]( const boost::system::error_code& error, std::size_t n )
+    {
+        if( error == boost::asio::error::eof )
+        {
+            End( *pair, dir );
+            return;
+        }
+        if( error )
+        {
+            Close( *pair );
+            return;
+        }
+        sDirection& d = pair->myDir[ dir ];
+        d.myBytes += n;
+        d.myChunks++;
+        if( mySampleEvery && d.myChunks % mySampleEvery == 0 )
+            Inspect( d );
+        boost::asio::async_write(
+            *d.myTo,
+            boost::asio::buffer( d.myBuffer.data(), n ),
+            [this, pair, dir]( const boost::system::error_code& error, std::size_t )
+        {
+            if( error )
+                Close( *pair );
+            else
+                Relay( pair, dir );
+        });
+    });
+#endif
+}
+
+void cSpliceProxy::Inspect( sDirection& d )
+{
+    cFrameHeader header;
+#ifdef __linux__
+    // duplicate the start of the chunk through a second pipe, leaving the original to be spliced on
+    int peek[2];
+    if( pipe2( peek, O_NONBLOCK | O_CLOEXEC ) )
+        return;
+    ssize_t n = tee( d.myPipe[0], peek[1], FRAME_HEADER_BYTES, SPLICE_F_NONBLOCK );
+    if( n == FRAME_HEADER_BYTES )
+        n = read( peek[0], header.myBytes, FRAME_HEADER_BYTES );
+    close( peek[0] );
+    close( peek[1] );
+    if( n != FRAME_HEADER_BYTES )
+        return;
+#else
+    if( d.myBuffer.size() < FRAME_HEADER_BYTES )
+        return;
+    memcpy( header.myBytes, d.myBuffer.data(), FRAME_HEADER_BYTES );
+#endif
+    if( header.IsValid() )
+        std::cout << "Proxy sample " << d.myName
+                  << " frame type " << std::hex << header.Type() << std::dec
+                  << " length " << header.Length() << "\n";
+    else
+        std::cout << "Proxy sample " << d.myName << " chunk starts mid frame\n";
+}
+
+void cSpliceProxy::End(
+    sPair& pair,
+    int dir )
+{
+    if( pair.myfClosed )
+        return;
+    sDirection& d = pair.myDir[ dir ];
+    d.myfEnded = true;
+    boost::system::error_code ec;
+    d.myTo->shutdown( boost::asio::ip::tcp::socket::shutdown_send, ec );
+    if( pair.myDir[ 1 - dir ].myfEnded || ec )
+        Close( pair );
+}
+
+void cSpliceProxy::Close( sPair& pair )
+{
+    if( pair.myfClosed )
+        return;
+    pair.myfClosed = true;
+    std::cout << "Proxy connection closed, relayed "
+              << pair.myDir[0].myBytes << " bytes " << pair.myDir[0].myName << ", "
+              << pair.myDir[1].myBytes << " bytes " << pair.myDir[1].myName << "\n";
+    boost::system::error_code ec;
+    pair.myDown.close( ec );
+    pair.myUp.close( ec );
+}
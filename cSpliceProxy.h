@@ -0,0 +1,113 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <boost/asio.hpp>
+
+#include "cClock.h"
+
+/// bytes moved by one splice call
+#define SPLICE_CHUNK_BYTES ( 64 * 1024 )
+
+/// msecs to wait before accepting again after accept fails, e.g. out of file descriptors
+#define PROXY_ACCEPT_RETRY_MSECS 100
+
+/** Transparent forwarding proxy
+
+    Accepts connections and relays each, both ways, to an upstream server.
+
+    On linux the bytes are moved socket to pipe to socket with splice(),
+    so they are never copied into user space.  Elsewhere they are copied through a buffer.
+
+    Optionally every Nth chunk is inspected: the chunk is duplicated with tee()
+    and, if it starts on a frame boundary, the frame header is reported.
+    Unsampled traffic is never looked at.
+
+    When one side finishes sending, the other side's sending is shut down
+    once everything already relayed has gone, and the other direction carries on
+    until it finishes too.  So a half-closed connection is relayed as such.
+*/
+class cSpliceProxy
+{
+public:
+
+    /** CTOR
+        @param[in] io_service the event manager
+        @param[in] listen_port port to accept connections on
+        @param[in] host upstream server
+        @param[in] port upstream server port
+        @param[in] sample_every inspect every Nth chunk, 0 for none
+
+        Starts accepting immediately
+    */
+    cSpliceProxy(
+        boost::asio::io_service& io_service,
+        int listen_port,
+        const std::string& host,
+        const std::string& port,
+        int sample_every = 0 );
+
+private:
+
+    struct sPair;
+
+    /// one direction of a relayed connection
+    struct sDirection
+    {
+        boost::asio::ip::tcp::socket * myFrom;
+        boost::asio::ip::tcp::socket * myTo;
+        int myPipe[2];                      /// pipe the bytes pass through, read end first
+        std::size_t myInPipe;               /// bytes in pipe waiting to go out
+        bool myfMore;                       /// the last fill filled the pipe, so the source likely has more
+        unsigned long long myBytes;
+        unsigned long long myChunks;
+        const char * myName;
+        bool myfEnded;                      /// source finished and everything relayed
+        std::vector< unsigned char > myBuffer;  /// copy buffer where splice is not available
+    };
+
+    /// a relayed connection
+    struct sPair
+    {
+        boost::asio::ip::tcp::socket myDown;
+        boost::asio::ip::tcp::socket myUp;
+        sDirection myDir[2];
+        bool myfClosed;
+
+        sPair( boost::asio::io_service& io_service );
+        ~sPair();
+    };
+
+    boost::asio::io_service& myIOService;
+    boost::asio::ip::tcp::acceptor myAcceptor;
+    std::string myHost;
+    std::string myPort;
+    int mySampleEvery;
+    std::shared_ptr< sPair > myPending;     /// pair waiting for a connection to accept
+    boost::asio::ip::tcp::resolver myResolver;  /// finds the upstream server for each new connection
+    event_timer_t myRetryTimer;             /// delays accepting again after a failure
+
+    void Accept();
+
+    void handle_accept( const boost::system::error_code& error );
+
+    /// upstream connection made, or failed, start relaying
+    void handle_connect(
+        std::shared_ptr< sPair > pair,
+        const boost::system::error_code& error );
+
+    /// move what can be moved without blocking, then wait for the socket that blocked
+    void Relay(
+        std::shared_ptr< sPair > pair,
+        int dir );
+
+    /// report frame header at start of sampled chunk
+    void Inspect( sDirection& d );
+
+    /// direction's source has finished, pass the end on
+    void End(
+        sPair& pair,
+        int dir );
+
+    void Close( sPair& pair );
+};
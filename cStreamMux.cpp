@@ -0,0 +1,258 @@
+#include "cStreamMux.h"
+
+cStreamMux::cStreamMux(
+    cNonBlockingTCPClient& client,
+    int window )
+    : myClient( client )
+    , myDefaultWindow( window )
+    , myConnectionCredit( CONNECTION_WINDOW_FRAMES )
+    , myConnectionConsumed( 0 )
+    , myConnectionQueued( 0 )
+{
+    myClient.FrameDestination(
+        std::bind( &cStreamMux::Destination, this,
+                   std::placeholders::_1, std::placeholders::_2 ));
+    myClient.FrameHandler(
+        std::bind( &cStreamMux::handle_frame, this,
+                   std::placeholders::_1, std::placeholders::_2, std::placeholders::_3 ));
+    myClient.WriteIdleHandler(
+        std::bind( &cStreamMux::Pump, this ));
+    myClient.ConnectHandler(
+        std::bind( &cStreamMux::Reset, this ));
+}
+
+void cStreamMux::Reset()
+{
+    myConnectionCredit = CONNECTION_WINDOW_FRAMES;
+    myConnectionConsumed = 0;
+    myConnectionQueued = 0;
+
+    // grants were for the old connection's windows
+    myControl.clear();
+    for( auto& it : myStreams )
+    {
+        sStream& s = it.second;
+        s.myCredit = s.myWindow;
+        s.myConsumed = 0;
+        s.myStale = s.myReceive.size();
+        if( s.myfBlocked )
+        {
+            s.myfBlocked = false;
+            myReady.push_back( it.first );
+        }
+    }
+    Pump();
+}
+
+cStreamMux::sStream& cStreamMux::Stream( int stream )
+{
+    sStream& s = myStreams[ stream ];
+    if( ! s.myWindow )
+    {
+        // peer starts with the same window we do
+        s.myWindow = myDefaultWindow;
+        s.myCredit = myDefaultWindow;
+    }
+    return s;
+}
+
+void cStreamMux::Send(
+    int stream,
+    const unsigned char * data,
+    std::size_t length )
+{
+    unsigned char header[ STREAM_HEADER_BYTES ];
+    header[0] = ( stream >> 8 ) & 0xff;
+    header[1] = stream & 0xff;
+    std::vector< boost::asio::const_buffer > parts;
+    parts.push_back( boost::asio::buffer( header ) );
+    parts.push_back( boost::asio::buffer( data, length ) );
+
+    sStream& s = Stream( stream );
+    if( ! s.mySend.size() )
+    {
+        if( s.myCredit > 0 )
+            myReady.push_back( stream );
+        else
+            s.myfBlocked = true;
+    }
+    s.mySend.push_back( EncodeFrame( FRAME_TYPE_STREAM_DATA, parts ) );
+
+    Pump();
+}
+
+void cStreamMux::Pump()
+{
+    // keep one frame at a time in the connection's queue
+    // so every stream gets its turn as soon as the socket is free
+    if( myClient.WriteQueueSize() || ! myClient.IsConnected() )
+        return;
+
+    // credit frames are not flow controlled and go first, so the peer is never starved
+    if( myControl.size() )
+    {
+        frame_buffer_t frame = myControl.front();
+        myControl.pop_front();
+        myClient.Send( frame );
+        return;
+    }
+
+    if( myConnectionCredit <= 0 || ! myReady.size() )
+        return;
+
+    int stream = myReady.front();
+    myReady.pop_front();
+    sStream& s = myStreams[ stream ];
+    frame_buffer_t frame = s.mySend.front();
+    s.mySend.pop_front();
+    s.myCredit--;
+    myConnectionCredit--;
+    if( s.mySend.size() )
+    {
+        if( s.myCredit > 0 )
+            myReady.push_back( stream );
+        else
+            s.myfBlocked = true;
+    }
+
+    myClient.Send( frame );
+}
+
+bool cStreamMux::Receive(
+    int stream,
+    std::vector< unsigned char >& data )
+{
+    auto it = myStreams.find( stream );
+    if( it == myStreams.end() || ! it->second.myReceive.size() )
+        return false;
+    sStream& s = it->second;
+    data.swap( s.myReceive.front() );
+    s.myReceive.pop_front();
+    if( s.myStale )
+    {
+        // received on an earlier connection, the peer's new window does not count it
+        s.myStale--;
+        return true;
+    }
+    myConnectionQueued--;
+
+    // room has been made, batch up credit for the peer
+    if( ++s.myConsumed >= ( s.myWindow + 1 ) / 2 )
+    {
+        Grant( stream, s.myConsumed );
+        s.myConsumed = 0;
+    }
+    if( ++myConnectionConsumed >= CONNECTION_WINDOW_FRAMES / 2 )
+    {
+        Grant( CONNECTION_STREAM, myConnectionConsumed );
+        myConnectionConsumed = 0;
+    }
+    return true;
+}
+
+void cStreamMux::Grant(
+    int stream,
+    int frames )
+{
+    unsigned char payload[ CREDIT_PAYLOAD_BYTES ];
+    payload[0] = ( stream >> 8 ) & 0xff;
+    payload[1] = stream & 0xff;
+    payload[2] = ( frames >> 24 ) & 0xff;
+    payload[3] = ( frames >> 16 ) & 0xff;
+    payload[4] = ( frames >> 8 ) & 0xff;
+    payload[5] = frames & 0xff;
+    std::vector< boost::asio::const_buffer > parts;
+    parts.push_back( boost::asio::buffer( payload ) );
+    myControl.push_back( EncodeFrame( FRAME_TYPE_CREDIT, parts ) );
+    Pump();
+}
+
+void cStreamMux::Credit(
+    int stream,
+    int frames )
+{
+    if( stream == CONNECTION_STREAM )
+    {
+        myConnectionCredit += frames;
+    }
+    else
+    {
+        sStream& s = Stream( stream );
+        s.myCredit += frames;
+        if( s.myfBlocked && s.myCredit > 0 )
+        {
+            s.myfBlocked = false;
+            myReady.push_back( stream );
+        }
+    }
+    Pump();
+}
+
+std::vector< boost::asio::mutable_buffer > cStreamMux::Destination(
+    int type,
+    std::size_t length )
+{
+    std::vector< boost::asio::mutable_buffer > dest;
+    if( type == FRAME_TYPE_CREDIT && length == CREDIT_PAYLOAD_BYTES )
+    {
+        dest.push_back( boost::asio::buffer( myCreditIn ) );
+        return dest;
+    }
+    if( type != FRAME_TYPE_STREAM_DATA || length < STREAM_HEADER_BYTES )
+        return dest;
+
+    // scatter the stream id into the header and the data straight into a new receive buffer
+    myIncoming.resize( length - STREAM_HEADER_BYTES );
+    dest.push_back( boost::asio::buffer( myIncomingHeader ) );
+    dest.push_back( boost::asio::buffer( myIncoming ) );
+    return dest;
+}
+
+void cStreamMux::handle_frame(
+    int type,
+    const std::vector< boost::asio::mutable_buffer >& payload,
+    std::size_t length )
+{
+    if( type == FRAME_TYPE_CREDIT && length == CREDIT_PAYLOAD_BYTES )
+    {
+        Credit(
+            ( myCreditIn[0] << 8 ) | myCreditIn[1],
+            ( myCreditIn[2] << 24 ) | ( myCreditIn[3] << 16 )
+            | ( myCreditIn[4] << 8 ) | myCreditIn[5] );
+        return;
+    }
+    if( type != FRAME_TYPE_STREAM_DATA || length < STREAM_HEADER_BYTES )
+    {
+        if( myOtherHandler )
+            myOtherHandler( type, payload, length );
+        else
+            std::cout << "frame type " << std::hex << type
+                      << std::dec << " " << length << " bytes\n";
+        return;
+    }
+
+    int stream = ( myIncomingHeader[0] << 8 ) | myIncomingHeader[1];
+    sStream& s = Stream( stream );
+    if( (int)s.myReceive.size() - s.myStale >= s.myWindow
+            || myConnectionQueued >= CONNECTION_WINDOW_FRAMES )
+    {
+        std::cout << "Stream " << stream << " peer sent without credit, closing connection\n";
+        myClient.Close();
+        return;
+    }
+    myConnectionQueued++;
+    s.myReceive.push_back( std::vector< unsigned char >() );
+    s.myReceive.back().swap( myIncoming );
+
+    if( myReceiveHandler )
+    {
+        myReceiveHandler( stream );
+    }
+    else
+    {
+        // nobody to consume the frame, take it now so the peer gets its credit back
+        std::vector< unsigned char > data;
+        Receive( stream, data );
+        std::cout << "stream " << stream << " " << data.size() << " bytes\n";
+    }
+}
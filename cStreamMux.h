@@ -0,0 +1,175 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+
+#include "cNonBlockingTCPClient.h"
+
+/// payload type of a frame carrying data for a logical stream
+#define FRAME_TYPE_STREAM_DATA 0xF001
+
+/// bytes of stream header at start of a stream frame payload: stream id (2)
+#define STREAM_HEADER_BYTES 2
+
+/// payload type of a frame granting send credit: stream id (2), frames (4)
+#define FRAME_TYPE_CREDIT 0xF002
+
+/// bytes of credit frame payload
+#define CREDIT_PAYLOAD_BYTES 6
+
+/// stream id used in credit frames to grant credit for the whole connection
+#define CONNECTION_STREAM 0xFFFF
+
+/// default number of received frames a stream may hold before the consumer takes them
+#define STREAM_WINDOW_FRAMES 64
+
+/// number of received stream frames the connection may hold, across all streams
+#define CONNECTION_WINDOW_FRAMES 1024
+
+/** Multiplex logical streams over one connection
+
+    A stream frame is an ordinary frame of type FRAME_TYPE_STREAM_DATA
+    whose payload starts with a 2 byte big endian stream id.
+
+    Each stream has its own send queue, receive queue and window.
+    Frames queued on different streams are interleaved round robin onto the socket,
+    with only one frame handed to the connection at a time,
+    so a stream with a long backlog cannot hold up the others.
+
+    Received stream data is read directly into the stream's receive queue.
+    Frames of other types are passed to the handler registered with FrameHandler().
+
+    Flow control is by credit, counted in frames.
+    Each end starts with credit for a window of frames on every stream
+    and for CONNECTION_WINDOW_FRAMES on the connection.
+    Sending a stream frame uses one credit from the stream and one from the connection,
+    a stream that runs out waits, without holding up the others, for a credit frame.
+    As the consumer takes received frames with Receive() the mux grants the peer
+    new credit, batched so one credit frame is sent per half window consumed.
+    So neither end ever queues more than a window, whatever the TCP windows allow.
+    A peer that sends beyond its credit is in error, and the connection is closed.
+
+    Both ends start afresh on a new connection: every window is full again.
+    Frames received before the reconnect are still delivered, but are not counted
+    against the new windows, and no credit is granted for them.
+
+    Use from the event manager thread.
+*/
+class cStreamMux
+{
+public:
+
+    /** CTOR
+        @param[in] client connection the streams share
+        @param[in] window received frames each stream may hold
+
+        Takes over the client's frame destination, frame handler, write idle handler and connect handler
+    */
+    cStreamMux(
+        cNonBlockingTCPClient& client,
+        int window = STREAM_WINDOW_FRAMES );
+
+    /** Queue data for sending on a stream
+        @param[in] stream id, 0 to 65534
+        @param[in] data
+        @param[in] length of data
+    */
+    void Send(
+        int stream,
+        const unsigned char * data,
+        std::size_t length );
+
+    /** Take oldest frame received on a stream
+        @param[in] stream id
+        @param[out] data frame payload, without the stream header
+        @return true if a frame was available
+    */
+    bool Receive(
+        int stream,
+        std::vector< unsigned char >& data );
+
+    /// Register handler called with stream id when a frame is received on a stream
+    void ReceiveHandler( std::function< void( int stream ) > handler )
+    {
+        myReceiveHandler = handler;
+    }
+
+    /// Register handler for frames that are not stream frames
+    void FrameHandler( cNonBlockingTCPClient::frame_handler_t handler )
+    {
+        myOtherHandler = handler;
+    }
+
+    /// Number of streams that have been used
+    std::size_t StreamCount() const
+    {
+        return myStreams.size();
+    }
+
+private:
+
+    struct sStream
+    {
+        std::deque< frame_buffer_t > mySend;
+        std::deque< std::vector< unsigned char > > myReceive;
+        int myWindow;                       /// frames that may be queued for receive
+        int myCredit;                       /// frames peer will accept on this stream
+        int myConsumed;                     /// frames consumed but not yet granted back to peer
+        int myStale;                        /// frames at front of myReceive from before a reconnect
+        bool myfBlocked;                    /// true if frames are waiting for credit
+
+        sStream()
+            : myWindow( 0 )
+            , myCredit( 0 )
+            , myConsumed( 0 )
+            , myStale( 0 )
+            , myfBlocked( false )
+        {
+
+        }
+    };
+
+    cNonBlockingTCPClient& myClient;
+    int myDefaultWindow;
+    std::unordered_map< int, sStream > myStreams;
+    std::deque< int > myReady;              /// streams with frames and credit to send, in round robin order
+    std::deque< frame_buffer_t > myControl; /// credit frames, sent ahead of stream frames
+    int myConnectionCredit;                 /// stream frames peer will accept on the connection
+    int myConnectionConsumed;               /// frames consumed but not yet granted back on the connection
+    int myConnectionQueued;                 /// stream frames held in receive queues
+    unsigned char myIncomingHeader[ STREAM_HEADER_BYTES ];
+    std::vector< unsigned char > myIncoming;
+    unsigned char myCreditIn[ CREDIT_PAYLOAD_BYTES ];
+    cNonBlockingTCPClient::frame_handler_t myOtherHandler;
+    std::function< void( int stream ) > myReceiveHandler;
+
+    /// find stream, creating it if new
+    sStream& Stream( int stream );
+
+    /// hand next frame, round robin, to the connection if it is idle
+    void Pump();
+
+    /// new connection, restart flow control with full windows
+    void Reset();
+
+    /// queue credit frame for peer
+    void Grant(
+        int stream,
+        int frames );
+
+    /// apply credit frame from peer
+    void Credit(
+        int stream,
+        int frames );
+
+    std::vector< boost::asio::mutable_buffer > Destination(
+        int type,
+        std::size_t length );
+
+    void handle_frame(
+        int type,
+        const std::vector< boost::asio::mutable_buffer >& payload,
+        std::size_t length );
+};
@@ -0,0 +1,77 @@
+#include "cTLS.h"
+
+std::mutex cTLS::theMutex;
+std::map< std::string, SSL_SESSION * > cTLS::theSessionCache;
+int cTLS::theKeyIndex = -1;
+
+cTLS::cTLS( const std::string& cafile )
+    : myContext( boost::asio::ssl::context::tls_client )
+    , myCAFile( cafile )
+{
+    myContext.set_options(
+        boost::asio::ssl::context::default_workarounds
+        | boost::asio::ssl::context::no_sslv2
+        | boost::asio::ssl::context::no_sslv3 );
+
+    if( cafile.length() )
+        myContext.load_verify_file( cafile );
+    else
+        myContext.set_default_verify_paths();
+    myContext.set_verify_mode( boost::asio::ssl::verify_peer );
+
+    // cache sessions ourselves, keyed by server, as they arrive
+    // ( TLS 1.3 tickets arrive after the handshake has completed )
+    SSL_CTX_set_session_cache_mode(
+        myContext.native_handle(),
+        SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE );
+    SSL_CTX_sess_set_new_cb( myContext.native_handle(), &cTLS::NewSession );
+
+    std::lock_guard<std::mutex> lck (theMutex);
+    if( theKeyIndex < 0 )
+        theKeyIndex = SSL_get_ex_new_index( 0, 0, 0, 0, &cTLS::FreeKey );
+}
+
+void cTLS::Prepare(
+    SSL * ssl,
+    const std::string& host,
+    const std::string& port )
+{
+    SSL_set_tlsext_host_name( ssl, host.c_str() );
+
+    // remember which server, verified against which certificates, this stream belongs to, for NewSession()
+    std::string * key = new std::string( myCAFile + "\n" + host + ":" + port );
+    SSL_set_ex_data( ssl, theKeyIndex, key );
+
+    std::lock_guard<std::mutex> lck (theMutex);
+    auto it = theSessionCache.find( *key );
+    if( it != theSessionCache.end() )
+        SSL_set_session( ssl, it->second );
+}
+
+int cTLS::NewSession( SSL * ssl, SSL_SESSION * session )
+{
+    std::string * key = (std::string *) SSL_get_ex_data( ssl, theKeyIndex );
+    if( ! key )
+        return 0;
+
+    std::lock_guard<std::mutex> lck (theMutex);
+    SSL_SESSION *& cached = theSessionCache[ *key ];
+    if( cached )
+        SSL_SESSION_free( cached );
+
+    // returning 1 keeps the reference OpenSSL passed us
+    cached = session;
+    return 1;
+}
+
+void cTLS::FreeKey(
+    void * parent, void * ptr, CRYPTO_EX_DATA * ad,
+    int idx, long argl, void * argp )
+{
+    delete (std::string *) ptr;
+}
+
+bool cTLS::Resumed( SSL * ssl )
+{
+    return SSL_session_reused( ssl ) == 1;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+
+/** TLS client configuration shared by all connections
+
+    Keeps a cache of TLS sessions, keyed by server, so that a reconnect
+    presents the server's session ticket and skips the full handshake.
+    The cache is shared by every cTLS, so the key includes the trusted certificates file:
+    a session verified under one trust store is never resumed under another.
+
+    Records are encrypted in user space: asio's ssl::stream drives OpenSSL
+    through memory BIOs, which kernel TLS offload cannot engage on.
+*/
+class cTLS
+{
+public:
+
+    /** CTOR
+        @param[in] cafile file of trusted certificates, e.g. a self-signed server certificate.
+                          Empty to use the system's default trust store.
+    */
+    cTLS( const std::string& cafile );
+
+    boost::asio::ssl::context& Context()
+    {
+        return myContext;
+    }
+
+    const std::string& CAFile() const
+    {
+        return myCAFile;
+    }
+
+    /** Prepare a new TLS stream before its handshake
+        @param[in] ssl native handle of stream
+        @param[in] host server host name, for certificate verification and SNI
+        @param[in] port server port
+
+        If a session for the server is cached it is offered for resumption.
+    */
+    void Prepare(
+        SSL * ssl,
+        const std::string& host,
+        const std::string& port );
+
+    /// true if the handshake resumed a cached session
+    static bool Resumed( SSL * ssl );
+
+private:
+    boost::asio::ssl::context myContext;
+    std::string myCAFile;
+
+    static std::mutex theMutex;
+    static std::map< std::string, SSL_SESSION * > theSessionCache;
+    static int theKeyIndex;
+
+    /// OpenSSL callback when the server issues a session ticket
+    static int NewSession( SSL * ssl, SSL_SESSION * session );
+
+    /// OpenSSL callback when a stream is freed, releases its server key
+    static void FreeKey(
+        void * parent, void * ptr, CRYPTO_EX_DATA * ad,
+        int idx, long argl, void * argp );
+};
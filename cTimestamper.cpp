@@ -0,0 +1,230 @@
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#ifdef __linux__
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <linux/sockios.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#endif
+
+#include "cTimestamper.h"
+#include "cNuma.h"
+
+cTimestamper::cTimestamper()
+    : myFD( -1 )
+    , myOffset( 0 )
+    , myArrival( 0 )
+{
+
+}
+
+std::uint64_t cTimestamper::Now()
+{
+    timespec ts;
+    clock_gettime( CLOCK_REALTIME, &ts );
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool cTimestamper::Covered(
+    std::uint64_t end,
+    std::uint32_t last )
+{
+    // the kernel's byte offsets are 32 bits and wrap
+    return (std::int32_t)( (std::uint32_t)( end - 1 ) - last ) <= 0;
+}
+
+std::uint64_t cTimestamper::Stamp( const timespec * ts )
+{
+    // prefer hardware
+    const timespec& t = ( ts[2].tv_sec || ts[2].tv_nsec ) ? ts[2] : ts[0];
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+bool cTimestamper::Enable( int fd )
+{
+#ifdef __linux__
+    myFD = fd;
+    myOffset = 0;
+    myPending.clear();
+    myArrival = 0;
+    unsigned int flags =
+        SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_TX_HARDWARE
+        | SOF_TIMESTAMPING_TX_ACK
+        | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_RX_HARDWARE
+        | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RAW_HARDWARE
+        | SOF_TIMESTAMPING_OPT_ID           // number transmit timestamps by byte offset
+        | SOF_TIMESTAMPING_OPT_TSONLY;      // do not loop the data back with them
+    if( setsockopt( fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof( flags )))
+    {
+        std::cout << "Timestamping not supported: " << strerror( errno ) << "\n";
+        myFD = -1;
+        return false;
+    }
+    EnableHardware( fd );
+    return true;
+#else
+    return false;
+#endif
+}
+
+void cTimestamper::EnableHardware( int fd )
+{
+#ifdef __linux__
+    std::string ifname = cNuma::SocketInterface( fd );
+    if( ! ifname.length() || ifname.length() >= IFNAMSIZ )
+    {
+        std::cout << "Hardware timestamps unavailable: interface unknown, using software\n";
+        return;
+    }
+    ifreq ifr;
+    memset( &ifr, 0, sizeof( ifr ));
+    strncpy( ifr.ifr_name, ifname.c_str(), IFNAMSIZ - 1 );
+    hwtstamp_config config;
+    memset( &config, 0, sizeof( config ));
+    ifr.ifr_data = (char*) &config;
+
+    // leave the NIC alone if it is already stamping everything, e.g. for ptp4l
+    if( ! ioctl( fd, SIOCGHWTSTAMP, &ifr )
+            && config.tx_type == HWTSTAMP_TX_ON
+            && config.rx_filter == HWTSTAMP_FILTER_ALL )
+        return;
+
+    config.flags = 0;
+    config.tx_type = HWTSTAMP_TX_ON;
+    config.rx_filter = HWTSTAMP_FILTER_ALL;
+    if( ioctl( fd, SIOCSHWTSTAMP, &ifr ))
+    {
+        std::cout << "Hardware timestamps unavailable on " << ifname
+                  << ": " << strerror( errno ) << ", using software\n";
+        return;
+    }
+    if( config.rx_filter != HWTSTAMP_FILTER_ALL )
+        std::cout << "Hardware timestamps on " << ifname
+                  << " cover only some received packets, others use software\n";
+#endif
+}
+
+void cTimestamper::Submitted( std::size_t bytes )
+{
+    if( myFD < 0 )
+        return;
+    myOffset += bytes;
+    if( myPending.size() >= TIMESTAMP_PENDING_FRAMES )
+        myPending.pop_front();
+    sPending p;
+    p.myEnd = myOffset;
+    p.mySubmitted = Now();
+    p.mySent = 0;
+    myPending.push_back( p );
+}
+
+void cTimestamper::Drain()
+{
+#ifdef __linux__
+    if( myFD < 0 )
+        return;
+    while( 1 )
+    {
+        char control[ 512 ];
+        msghdr msg;
+        memset( &msg, 0, sizeof( msg ));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof( control );
+        if( recvmsg( myFD, &msg, MSG_ERRQUEUE | MSG_DONTWAIT ) < 0 )
+            return;
+
+        const scm_timestamping * stamps = 0;
+        const sock_extended_err * err = 0;
+        for( cmsghdr * c = CMSG_FIRSTHDR( &msg ); c; c = CMSG_NXTHDR( &msg, c ))
+        {
+            if( c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPING )
+                stamps = (const scm_timestamping *) CMSG_DATA( c );
+            else if(( c->cmsg_level == SOL_IP && c->cmsg_type == IP_RECVERR )
+                    || ( c->cmsg_level == SOL_IPV6 && c->cmsg_type == IPV6_RECVERR ))
+                err = (const sock_extended_err *) CMSG_DATA( c );
+        }
+        if( ! stamps || ! err || err->ee_origin != SO_EE_ORIGIN_TIMESTAMPING )
+            continue;
+
+        // the timestamp covers every write up to and including the one ending at byte ee_data
+        std::uint64_t t = Stamp( stamps->ts );
+        std::uint32_t last = err->ee_data;
+        if( err->ee_info == SCM_TSTAMP_SND )
+        {
+            for( auto& p : myPending )
+            {
+                if( ! Covered( p.myEnd, last ))
+                    break;
+                if( ! p.mySent )
+                {
+                    p.mySent = t;
+                    myTxInProcess.Add( t > p.mySubmitted ? t - p.mySubmitted : 0 );
+                }
+            }
+        }
+        else if( err->ee_info == SCM_TSTAMP_ACK )
+        {
+            while( myPending.size() && Covered( myPending.front().myEnd, last ))
+            {
+                const sPending& p = myPending.front();
+                std::uint64_t sent = p.mySent ? p.mySent : p.mySubmitted;
+                myTxOnWire.Add( t > sent ? t - sent : 0 );
+                myPending.pop_front();
+            }
+        }
+    }
+#endif
+}
+
+bool cTimestamper::Arrival()
+{
+#ifdef __linux__
+    myArrival = 0;
+    if( myFD < 0 )
+        return false;
+    char byte;
+    iovec iov;
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    char control[ 256 ];
+    msghdr msg;
+    memset( &msg, 0, sizeof( msg ));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof( control );
+
+    // peek, so the byte is still there for the frame header read
+    if( recvmsg( myFD, &msg, MSG_PEEK | MSG_DONTWAIT ) != 1 )
+        return false;
+    for( cmsghdr * c = CMSG_FIRSTHDR( &msg ); c; c = CMSG_NXTHDR( &msg, c ))
+    {
+        if( c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPING )
+        {
+            myArrival = Stamp( ((const scm_timestamping *) CMSG_DATA( c ))->ts );
+            return true;
+        }
+    }
+#endif
+    return false;
+}
+
+void cTimestamper::Dispatched()
+{
+    if( ! myArrival )
+        return;
+    std::uint64_t now = Now();
+    myRxInProcess.Add( now > myArrival ? now - myArrival : 0 );
+    myArrival = 0;
+}
+
+void cTimestamper::Print() const
+{
+    myRxInProcess.Print( "Receive in-process, arrival to dispatch" );
+    myTxInProcess.Print( "Transmit in-process, submit to leaving host" );
+    myTxOnWire.Print( "Transmit on-wire, leaving host to acknowledgement" );
+}
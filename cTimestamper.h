@@ -0,0 +1,102 @@
+#pragma once
+
+#include <deque>
+#include <cstdint>
+#include <ctime>
+
+#include "cHistogram.h"
+
+// most frames remembered while waiting for their transmit timestamps
+#define TIMESTAMP_PENDING_FRAMES 65536
+
+/** Kernel and NIC timestamps of a connection's traffic
+
+    Uses SO_TIMESTAMPING to tell time spent in this process from time spent on the network.
+
+    Transmit: the kernel reports, on the socket's error queue, when the last byte of each write
+    was handed to the NIC driver ( or left the NIC, where it timestamps in hardware )
+    and when the server acknowledged it.  Matched against the time each frame's write was submitted:
+
+        in-process  submit to leaving the host
+        on-wire     leaving the host to acknowledgement, the network round trip
+
+    Receive: the kernel timestamps each packet as it arrives.
+    The timestamp of the packet holding the start of a frame header is peeked before the header is read,
+    and compared with the time the frame is dispatched:
+
+        in-process  arrival to dispatch
+
+    Hardware timestamping is switched on for the connection's interface ( SIOCSHWTSTAMP, needs CAP_NET_ADMIN
+    and changes the setting for every user of the NIC ).  Where that fails software timestamps are used.
+    Hardware timestamps are compared with the system clock, so the NIC clock must be synchronised to it,
+    e.g. by phc2sys.
+*/
+class cTimestamper
+{
+public:
+
+    cTimestamper();
+
+    /** Start timestamping a newly connected socket
+        @param[in] fd socket, before anything has been written
+        @return true if the kernel supports timestamping
+    */
+    bool Enable( int fd );
+
+    /// stop timestamping, the socket is closing
+    void Disable()
+    {
+        myFD = -1;
+    }
+
+    /** Write submitted
+        @param[in] bytes being written
+    */
+    void Submitted( std::size_t bytes );
+
+    /// collect transmit timestamps from the socket's error queue
+    void Drain();
+
+    /** Peek arrival time of next byte to be read
+        @return true if a timestamp was found
+    */
+    bool Arrival();
+
+    /// frame whose header arrival was peeked has been dispatched
+    void Dispatched();
+
+    /// print histograms
+    void Print() const;
+
+private:
+
+    /// switch on hardware timestamping at the NIC the socket uses, if possible
+    static void EnableHardware( int fd );
+
+    /// a write waiting for its timestamps
+    struct sPending
+    {
+        std::uint64_t myEnd;            /// offset of byte after last byte of write
+        std::uint64_t mySubmitted;      /// when submitted, nanoseconds
+        std::uint64_t mySent;           /// when it left the host, 0 if not yet known
+    };
+
+    int myFD;
+    std::uint64_t myOffset;             /// bytes submitted since timestamping started
+    std::deque< sPending > myPending;
+    std::uint64_t myArrival;            /// arrival of frame being read, 0 if unknown
+    cHistogram myTxInProcess;
+    cHistogram myTxOnWire;
+    cHistogram myRxInProcess;
+
+    /// system clock, nanoseconds, the clock kernel timestamps use
+    static std::uint64_t Now();
+
+    /// true if write ending at offset end is covered by a timestamp of the write ending at byte last
+    static bool Covered(
+        std::uint64_t end,
+        std::uint32_t last );
+
+    /// timestamp from the kernel's triple: software, deprecated, hardware
+    static std::uint64_t Stamp( const timespec * ts );
+};
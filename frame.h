@@ -0,0 +1,224 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <functional>
+#include <memory>
+#include <cstring>
+#include <cstddef>
+#include <boost/asio/buffer.hpp>
+
+#include "cBufferArena.h"
+
+/// bytes in frame header: version, inverse version, payload type (2), payload length (4)
+#define FRAME_HEADER_BYTES 8
+
+/** Header of a 0x02 0xFD frame
+
+    All multi-byte fields are big endian
+*/
+class cFrameHeader
+{
+public:
+    unsigned char myBytes[ FRAME_HEADER_BYTES ];
+
+    /// true if header starts with the protocol version and its inverse
+    bool IsValid() const
+    {
+        return myBytes[0] == 0x02 && myBytes[1] == 0xfd;
+    }
+
+    /// payload type
+    int Type() const
+    {
+        return ( myBytes[2] << 8 ) | myBytes[3];
+    }
+
+    /// number of payload bytes that follow the header
+    std::size_t Length() const
+    {
+        return ( (std::size_t)myBytes[4] << 24 )
+               | ( (std::size_t)myBytes[5] << 16 )
+               | ( (std::size_t)myBytes[6] << 8 )
+               | myBytes[7];
+    }
+
+    /// construct valid header for payload
+    void Set( int type, std::size_t length )
+    {
+        myBytes[0] = 0x02;
+        myBytes[1] = 0xfd;
+        myBytes[2] = ( type >> 8 ) & 0xff;
+        myBytes[3] = type & 0xff;
+        myBytes[4] = ( length >> 24 ) & 0xff;
+        myBytes[5] = ( length >> 16 ) & 0xff;
+        myBytes[6] = ( length >> 8 ) & 0xff;
+        myBytes[7] = length & 0xff;
+    }
+};
+
+/// a complete encoded frame, header and payload, shared by everything that sends it
+typedef std::shared_ptr< const std::vector< unsigned char > > frame_buffer_t;
+
+/** Encode a frame
+    @param[in] type payload type
+    @param[in] parts buffers that are concatenated to form the payload
+    @return encoded frame
+*/
+inline frame_buffer_t EncodeFrame(
+    int type,
+    const std::vector< boost::asio::const_buffer >& parts )
+{
+    std::size_t length = boost::asio::buffer_size( parts );
+    // vector and reference count in one allocation
+    std::shared_ptr< std::vector< unsigned char > > frame =
+        std::make_shared< std::vector< unsigned char > >( FRAME_HEADER_BYTES + length );
+    cFrameHeader header;
+    header.Set( type, length );
+    memcpy( frame->data(), header.myBytes, FRAME_HEADER_BYTES );
+    boost::asio::buffer_copy(
+        boost::asio::buffer( frame->data() + FRAME_HEADER_BYTES, length ),
+        parts );
+    return frame;
+}
+
+/** Pool of fixed size slots that frame payloads can be read into
+
+    The storage is allocated once, from a buffer arena if one is given,
+    so acquiring and releasing a slot never touches the heap.  Thread safe.
+
+    A user that finds every slot in use can wait for one:
+    the next Release() calls it, so it need not poll the pool.
+*/
+class cFrameSlotPool
+{
+public:
+
+    /** CTOR
+        @param[in] slot_count number of slots
+        @param[in] slot_bytes size of each slot
+        @param[in] arena to carve slots from, 0 to use the heap
+
+        If the arena is exhausted the heap is used.
+    */
+    cFrameSlotPool(
+        int slot_count,
+        std::size_t slot_bytes,
+        cBufferArena * arena = 0 )
+        : mySlotBytes( slot_bytes )
+    {
+        unsigned char * base = 0;
+        if( arena )
+            base = (unsigned char *) arena->Allocate( slot_count * slot_bytes );
+        if( ! base )
+        {
+            myStore.resize( slot_count * slot_bytes );
+            base = myStore.data();
+        }
+        for( int k = slot_count - 1; k >= 0; k-- )
+            myFree.push_back( base + k * slot_bytes );
+    }
+
+    /** Acquire a slot
+        @return pointer to slot, or 0 if all slots are in use
+    */
+    unsigned char * Acquire()
+    {
+        std::lock_guard<std::mutex> lck (myMutex);
+        if( ! myFree.size() )
+            return 0;
+        unsigned char * slot = myFree.back();
+        myFree.pop_back();
+        return slot;
+    }
+
+    /** Acquire a slot, or wait for one if all are in use
+        @param[in] owner of the wait, so Cancel() can find it
+        @param[in] ready called once, by the next Release(), in the thread that releases
+        @return pointer to slot, or 0 if waiting
+
+        The slot is not reserved for the waiter, it should try again when ready is called,
+        or call Pass() if it no longer wants one.
+    */
+    unsigned char * Acquire(
+        const void * owner,
+        std::function< void() > ready )
+    {
+        std::lock_guard<std::mutex> lck (myMutex);
+        if( ! myFree.size() )
+        {
+            sWaiter w;
+            w.myOwner = owner;
+            w.myReady = ready;
+            myWaiting.push_back( w );
+            return 0;
+        }
+        unsigned char * slot = myFree.back();
+        myFree.pop_back();
+        return slot;
+    }
+
+    /// forget the waits of owner, their ready is not called
+    void Cancel( const void * owner )
+    {
+        std::lock_guard<std::mutex> lck (myMutex);
+        for( auto it = myWaiting.begin(); it != myWaiting.end(); )
+        {
+            if( it->myOwner == owner )
+                it = myWaiting.erase( it );
+            else
+                it++;
+        }
+    }
+
+    /// Return slot to pool, waking the longest waiter
+    void Release( unsigned char * slot )
+    {
+        if( ! slot )
+            return;
+        {
+            std::lock_guard<std::mutex> lck (myMutex);
+            myFree.push_back( slot );
+        }
+        Pass();
+    }
+
+    /** Wake the longest waiter, if a slot is free
+
+        A waiter whose ready was called, but no longer wants a slot, must call this
+        so the wakeup goes on to the next waiter rather than being lost.
+    */
+    void Pass()
+    {
+        std::function< void() > ready;
+        {
+            std::lock_guard<std::mutex> lck (myMutex);
+            if( ! myFree.size() || ! myWaiting.size() )
+                return;
+            ready = myWaiting.front().myReady;
+            myWaiting.pop_front();
+        }
+
+        // outside the lock, the waiter may acquire straight away
+        ready();
+    }
+
+    std::size_t SlotBytes() const
+    {
+        return mySlotBytes;
+    }
+
+private:
+    struct sWaiter
+    {
+        const void * myOwner;
+        std::function< void() > myReady;
+    };
+
+    std::vector< unsigned char > myStore;
+    std::vector< unsigned char * > myFree;
+    std::deque< sWaiter > myWaiting;        /// users waiting for a slot, oldest first
+    std::size_t mySlotBytes;
+    std::mutex myMutex;
+};
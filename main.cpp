@@ -2,103 +2,58 @@
 #include <string>
 #include <thread>
 #include <mutex>
+#include <vector>
+#include <fstream>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#include "cNonBlockingTCPClient.h"
+#include "cStreamMux.h"
+#include "cSpliceProxy.h"
+#include "cNetemProxy.h"
+#include "cBroadcast.h"
+#include "cResponseCache.h"
+#include "cNuma.h"
+#include "cHandoff.h"
+#include "cPrefork.h"
+#include "cPerfCounters.h"
+#include "cMetricsPage.h"
+#include "cIdleReaper.h"
+#include "cCompactClient.h"
+#include "cFrameMerge.h"
+#include "cClock.h"
 
 using namespace std;
 
-#define MAX_PACKET_SIZE_BYTES 1024
+// capacity of the buffer arena, one huge page
+#define ARENA_BYTES ( 2 * 1024 * 1024 )
+
+// memory cap of the response cache
+#define RESPONSE_CACHE_BYTES ( 1024 * 1024 )
 
 // set work time to 2 seconds
 // to slow things down for debugfging purposes
 // you can reduce this to 500 for production
 #define WORK_TIME_MSECS 2000
 
-/** A non-blocking TCP client */
-class cNonBlockingTCPClient
-{
-public:
-
-    /** CTOR
-        param[in] io_service the event manager
-    */
-
-    cNonBlockingTCPClient(
-        boost::asio::io_service& io_service )
-        : myIOService( io_service )
-        , myTimer( new boost::asio::deadline_timer( io_service ))
-    {
-
-    }
-
-    /** Connect to server
-        @param[in] ip address of server
-        @param[in] port server is listening to for connections
-
-        This does not return until the connection attempt successds or fails.
-        The return occurs so quickly that it does not seem wiorthwhile
-        to make this non-blocking.
-
-        On successful connection a pre-defined message is sent to the server
-        this is non-blocking and when the message has been sent handle_connect_write() will be called
-    */
-    void Connect(
-        const std::string& ip,
-        const std::string& port);
+// interval between updates of the shared memory metrics page
+#define METRICS_PUBLISH_MSECS 100
 
-    /** read message from server
-        @param[in] byte_count to be read
-
-        This is non-blocking, returning immediatly.
-        When sufficient bytes arrive from the server
-        the method handle_read() will be called
-    */
-    void Read( int byte_count );
-
-    /** write pre-defined message to server
-
-        This is non-blocking, returning immediatly.
-        When write completes
-        the method handle_write() will be called
-    */
-    void Write();
-
-
-private:
-    boost::asio::io_service& myIOService;
-    boost::asio::ip::tcp::tcp::socket * mySocketTCP;
-    boost::asio::deadline_timer * myTimer;
-    enum class constatus
-    {
-        no,                             /// there is no connection
-        yes,                            /// connected
-        not_yet                          /// Connection is being made, not yet complete
-    }
-    myConnection;
-    unsigned char myRcvBuffer [ MAX_PACKET_SIZE_BYTES ];
-    unsigned char myConnectMessage[15] {0x02, 0xfd, 00, 0x05, 00, 00, 00, 07, 0x0f, 0x0d, 0x00, 0x00, 0x00, 0x00, 0x00};
-    unsigned char myWriteMessage[15] {0x02, 0xfd, 0x80, 0x01, 00, 00, 00, 07, 0x0f, 0x0d, 0xAA, 0xBB, 0x22, 0x11, 0x22};
-
-    void handle_read(
-        const boost::system::error_code& error,
-        std::size_t bytes_received );
-
-    void handle_connect_write(
-        const boost::system::error_code& error,
-        std::size_t bytes_sent );
-
-    void handle_write(
-        const boost::system::error_code& error,
-        std::size_t bytes_sent );
-};
+// frame slots shared by a prefork worker's connections, enough for those part way through a frame at once
+#define SHARED_SLOT_COUNT 256
 
 class cWorkSimulator
 {
 public:
 
     cWorkSimulator( boost::asio::io_service& io_service)
-        : myTimer( new boost::asio::deadline_timer( io_service ))
+        : myTimer( new event_timer_t( io_service ))
+        , myfWaitOnUser( false )
         , myfStop( false )
+        , myJobs( 0 )
     {
 
     }
@@ -112,16 +67,16 @@ public:
 
     void FinishWork()
     {
+        cPerfStage perf( cPerfCounters::stage::work );
         if( StopGet() )
         {
             std::cout << "Stopping\n";
             return;
         }
+        myJobs++;
         if( ! myfWaitOnUser)
         {
-            static int count;
-            count++;
-            std::cout << "Completed Job " << count << "\n";
+            std::cout << "Completed Job " << myJobs << "\n";
         }
 
         // start another job
@@ -153,11 +108,17 @@ public:
         std::lock_guard<std::mutex> lck (myMutex);
         return myfStop;
     }
+    /// Number of jobs completed
+    int Jobs() const
+    {
+        return myJobs;
+    }
 private:
-    boost::asio::deadline_timer * myTimer;
+    event_timer_t * myTimer;
     std::mutex myMutex;
     bool myfWaitOnUser;
     bool myfStop;
+    int myJobs;
 };
 
 
@@ -169,10 +130,16 @@ class cCommander
 public:
     cCommander(
         boost::asio::io_service& io_service,
-        cNonBlockingTCPClient& TCP )
+        cNonBlockingTCPClient& TCP,
+        cStreamMux& Mux,
+        cBroadcast& Broadcast,
+        cResponseCache& Cache )
         : myIOService( io_service )
         , myTCP( TCP )
-        , myTimer( new boost::asio::deadline_timer( io_service ))
+        , myMux( Mux )
+        , myBroadcast( Broadcast )
+        , myCache( Cache )
+        , myTimer( new event_timer_t( io_service ))
     {
         CheckForCommand();
     }
@@ -192,8 +159,11 @@ public:
 
 private:
     boost::asio::io_service& myIOService;
-    boost::asio::deadline_timer * myTimer;
+    event_timer_t * myTimer;
     cNonBlockingTCPClient & myTCP;
+    cStreamMux & myMux;
+    cBroadcast & myBroadcast;
+    cResponseCache & myCache;
     std::string myCommand;
     std::mutex myMutex;
 
@@ -249,8 +219,15 @@ void cKeyboard::Start()
     std::cout << "\nKeyboard monitor running\n\n"
               "   To pause for user input type 'q<ENTER>\n"
               "   To connect to server type 'C <ip> <port><ENTER>\n"
+              "   To connect to server over TLS type 'C <ip> <port> tls [<CA file>]<ENTER>\n"
               "   To read from server type 'R <byte count><ENTER>\n"
+              "   To read one frame from server type 'F<ENTER>\n"
               "   To send a pre-defined message to the server type 'W'\n"
+              "   To send text on a logical stream type 'S <stream> <text><ENTER>\n"
+              "   To send text to every connection type 'B <text><ENTER>\n"
+              "   To send text as a request and wait for the response type 'E <text><ENTER>\n"
+              "   To report hardware performance counters ( needs --perf ) type 'P'\n"
+              "   To report kernel timestamp latencies ( needs --timestamps ) type 'T'\n"
               "   To stop type 'x<ENTER>' ( DO NOT USE ctrlC )\n\n"
               "   Don't forget to hit <ENTER>!\n\n";
 
@@ -280,8 +257,20 @@ void cKeyboard::Start()
         case 'C':
         case 'r':
         case 'R':
+        case 'f':
+        case 'F':
         case 'w':
         case 'W':
+        case 's':
+        case 'S':
+        case 'b':
+        case 'B':
+        case 'e':
+        case 'E':
+        case 'p':
+        case 'P':
+        case 't':
+        case 'T':
 
             // register command with TCP client
             myCommander->Command( cmd );
@@ -317,9 +306,21 @@ void cCommander::CheckForCommand()
                 myTCP.Read( atoi( vcmd[1].c_str()));
             break;
 
+        case 'f':
+        case 'F':
+            myTCP.ReadFrame();
+            break;
+
         case 'c':
         case 'C':
-            myTCP.Connect( vcmd[1], vcmd[2] );
+            if( vcmd.size() < 3 )
+                std::cout << "Connect command missing ip or port\n";
+            else if( vcmd.size() > 3 && vcmd[3] == "tls" )
+                myTCP.Connect(
+                    vcmd[1], vcmd[2], true,
+                    vcmd.size() > 4 ? vcmd[4] : "" );
+            else
+                myTCP.Connect( vcmd[1], vcmd[2] );
             break;
 
         case 'w':
@@ -327,9 +328,72 @@ void cCommander::CheckForCommand()
             myTCP.Write();
             break;
 
+        case 's':
+        case 'S':
+            if( vcmd.size() < 3 )
+                std::cout << "Stream command missing stream or text\n";
+            else
+            {
+                // replies arrive on the stream, so keep reading frames
+                myTCP.ReadFrames();
+                myMux.Send(
+                    atoi( vcmd[1].c_str() ),
+                    (const unsigned char *) vcmd[2].data(),
+                    vcmd[2].length() );
+            }
+            break;
+
+        case 'b':
+        case 'B':
+            if( vcmd.size() < 2 )
+                std::cout << "Broadcast command missing text\n";
+            else
+            {
+                std::vector< boost::asio::const_buffer > parts;
+                parts.push_back( boost::asio::buffer( vcmd[1] ));
+                std::cout << "Broadcast to "
+                          << myBroadcast.Send( 0x8001, parts )
+                          << " of " << myBroadcast.Size() << " connections\n";
+            }
+            break;
+
+        case 'e':
+        case 'E':
+            if( vcmd.size() < 2 )
+                std::cout << "Request command missing text\n";
+            else
+                myCache.Request(
+                    0x8001,
+                    (const unsigned char *) vcmd[1].data(),
+                    vcmd[1].length(),
+                    []( bool ok, int type, const std::vector< unsigned char >& payload )
+            {
+                if( ! ok )
+                {
+                    std::cout << "Request failed\n";
+                    return;
+                }
+                std::cout << "Response type " << std::hex << type << std::dec
+                          << " " << payload.size() << " bytes\n";
+            });
+            break;
+
+        case 'p':
+        case 'P':
+            cPerfCounters::Report();
+            break;
+
+        case 't':
+        case 'T':
+            if( myTCP.Timestamps() )
+                myTCP.Timestamps()->Print();
+            break;
+
         case 'x':
         case 'X':
-            // stop command, return without scheduling another check
+            // stop command, close connection so its reads no longer keep the event manager running
+            // and return without scheduling another check
+            myTCP.Close();
             return;
 
         default:
@@ -358,147 +422,748 @@ std::string cCommander::Command()
     return myCommand;
 }
 
-void cNonBlockingTCPClient::Connect(
-    const std::string& ip,
-    const std::string& port)
+/// true if option appears on the command line
+bool HasOption( int argc, char* argv[], const std::string& opt )
 {
-    try
-    {
-        boost::system::error_code ec;
-        boost::asio::ip::tcp::tcp::resolver resolver( myIOService );
-        boost::asio::ip::tcp::tcp::resolver::query query(
-            ip,
-            port );
-        boost::asio::ip::tcp::tcp::resolver::iterator endpoint_iterator = resolver.resolve(query,ec);
-        if( ec )
-            throw std::runtime_error("resolve");
-        mySocketTCP = new boost::asio::ip::tcp::tcp::socket( myIOService );
-        boost::asio::connect( *mySocketTCP, endpoint_iterator, ec );
-        if ( ec || ( ! mySocketTCP->is_open() ) )
-        {
-            // connection failed
-            delete mySocketTCP;
-            mySocketTCP = 0;
-            myConnection = constatus::no;
-            std::cout << "Client Connection failed\n";
+    for( int k = 1; k < argc; k++ )
+        if( opt == argv[k] )
+            return true;
+    return false;
+}
+
+/// value following option on the command line, empty if option absent
+std::string OptionValue( int argc, char* argv[], const std::string& opt )
+{
+    for( int k = 1; k < argc - 1; k++ )
+        if( opt == argv[k] )
+            return argv[k+1];
+    return "";
+}
+
+/** Configure source addresses of outbound connections from the command line
+    @param[in] argc
+    @param[in] argv
+    @param[out] sources pool to configure
+    @return false if an option is invalid
 
+    '--source <ip,ip,...>'      local addresses to spread connections over
+    '--ports <first>-<last>'    take source ports from the range, rather than leaving the kernel to choose
+*/
+bool SourceOptions( int argc, char* argv[], cSourcePool& sources )
+{
+    std::string opt = OptionValue( argc, argv, "--source" );
+    if( opt.length() && ! sources.AddList( opt ))
+        return false;
+    opt = OptionValue( argc, argv, "--ports" );
+    if( opt.length() )
+    {
+        int first = 0, last = 0;
+        if( sscanf( opt.c_str(), "%d-%d", &first, &last ) != 2
+                || first < 1 || last > 65535 || last < first )
+        {
+            std::cout << "Invalid port range " << opt << "\n";
+            return false;
         }
-        else
+        if( sources.Empty() )
+            sources.Add( "0.0.0.0" );
+        sources.PortRange( first, last );
+    }
+    return true;
+}
+
+/** Choose the NUMA node the event manager thread and buffers live on
+    @param[in] argc
+    @param[in] argv
+
+    '--node <n>'        use node n
+    '--nic <ifname>'    use the node the network interface is attached to
+
+    With an option the calling thread is pinned to the node's CPUs,
+    and threads it starts later inherit the pin.
+    With no option, or if the node is unknown, nothing is pinned
+    and the node the thread is already running on is used for buffers.
+*/
+int NUMAHome( int argc, char* argv[] )
+{
+    int node = -1;
+    for( int k = 1; k < argc - 1; k++ )
+    {
+        std::string opt( argv[k] );
+        if( opt == "--node" )
+            node = atoi( argv[k+1] );
+        else if( opt == "--nic" )
         {
-            myConnection = constatus::yes;
-            std::cout << "Client Connected OK\n";
-
-            boost::asio::async_write(
-                *mySocketTCP,
-                boost::asio::buffer(myConnectMessage, 15),
-                boost::bind(&cNonBlockingTCPClient::handle_connect_write, this,
-                            boost::asio::placeholders::error,
-                            boost::asio::placeholders::bytes_transferred ));
+            node = cNuma::NICNode( argv[k+1] );
+            if( node < 0 )
+                std::cout << "NUMA node of " << argv[k+1] << " unknown\n";
         }
     }
+    if( node < 0 )
+        return cNuma::CurrentNode();
+    if( cNuma::PinThisThread( node ) )
+        std::cout << "Event manager pinned to NUMA node " << node
+                  << " of " << cNuma::NodeCount() << "\n";
+    return node;
+}
+
+/** Run as forwarding proxy
 
-    catch ( ... )
+    'proxy <listen port> <server ip> <server port> [--sample <N>]'
+
+    Runs until killed
+*/
+int ProxyMain( int argc, char* argv[] )
+{
+    if( argc < 5 )
     {
-        std::cout << "Client Connection failed 2\n";
+        std::cout << "usage: proxy <listen port> <server ip> <server port> [--sample <N>]\n";
+        return 1;
     }
+    int sample = 0;
+    for( int k = 5; k < argc - 1; k++ )
+        if( std::string( argv[k] ) == "--sample" )
+            sample = atoi( argv[k+1] );
+
+    boost::asio::io_service io_service;
+    cSpliceProxy theProxy(
+        io_service,
+        atoi( argv[2] ),
+        argv[3],
+        argv[4],
+        sample );
+    io_service.run();
+    return 0;
 }
-void cNonBlockingTCPClient::Read( int byte_count )
+
+/** Run as proxy emulating network conditions
+
+    'netem <listen port> <server ip> <server port> [--latency <msecs>] [--jitter <msecs>]
+        [--bandwidth <kbit/s>] [--reorder <percent>] [--reset <secs>] [--seed <N>]'
+*/
+int NetemMain( int argc, char* argv[] )
 {
-    if( myConnection != constatus::yes )
+    if( argc < 5 )
     {
-        std::cout << "Read Request but no connection\n";
-        return;
+        std::cout << "usage: netem <listen port> <server ip> <server port>"
+                  " [--latency <msecs>] [--jitter <msecs>] [--bandwidth <kbit/s>]"
+                  " [--reorder <percent>] [--reset <secs>] [--seed <N>]\n";
+        return 1;
     }
-    if( byte_count < 1 )
+    sNetemConditions conditions;
+    std::string opt = OptionValue( argc, argv, "--latency" );
+    if( opt.length() )
+        conditions.myLatencyMsecs = atoi( opt.c_str() );
+    opt = OptionValue( argc, argv, "--jitter" );
+    if( opt.length() )
+        conditions.myJitterMsecs = atoi( opt.c_str() );
+    opt = OptionValue( argc, argv, "--bandwidth" );
+    if( opt.length() )
+        conditions.myBandwidthKbps = atoi( opt.c_str() );
+    opt = OptionValue( argc, argv, "--reorder" );
+    if( opt.length() )
+        conditions.myReorderPercent = atoi( opt.c_str() );
+    opt = OptionValue( argc, argv, "--reset" );
+    if( opt.length() )
+        conditions.myResetSecs = atoi( opt.c_str() );
+    opt = OptionValue( argc, argv, "--seed" );
+    if( opt.length() )
+        conditions.mySeed = atoi( opt.c_str() );
+
+    boost::asio::io_service io_service;
+    cNetemProxy theProxy(
+        io_service,
+        atoi( argv[2] ),
+        argv[3],
+        argv[4],
+        conditions );
+    io_service.run();
+    return 0;
+}
+
+#ifdef __linux__
+
+/** Prefork worker, runs its share of the connections until they have all closed
+    @param[in] worker index
+    @param[in] workers number of workers
+    @param[in] metrics to publish to supervisor
+    @param[in] ip of server
+    @param[in] port of server
+    @param[in] connections number of connections to open
+    @param[in] idle_msecs quiet time after which a connection releases its buffers, 0 for never
+    @param[in] ttl_msecs quiet time after which a connection is closed, 0 for never
+    @param[in] sources local addresses to connect from
+    @return exit code, non-zero since a worker that ends has failed
+*/
+int PreforkWorker(
+    int worker,
+    int workers,
+    sWorkerMetrics& metrics,
+    const std::string& ip,
+    const std::string& port,
+    int connections,
+    unsigned int idle_msecs,
+    unsigned int ttl_msecs,
+    const cSourcePool& sources )
+{
+    // spread workers over the NUMA nodes
+    int node = -1;
+    std::vector< int > nodes = cNuma::Nodes();
+    if( nodes.size() > 1 )
+    {
+        node = nodes[ worker % nodes.size() ];
+        cNuma::PinThisThread( node );
+    }
+
+    boost::asio::io_service io_service;
+    cBufferArena theArena( ARENA_BYTES, node );
+    cConnectionTable theTable;
+
+    // connections borrow a slot only while reading a frame, so memory tracks the active connections
+    cFrameSlotPool thePool( SHARED_SLOT_COUNT, MAX_PACKET_SIZE_BYTES, &theArena );
+    // each worker takes its own slice of the source port range, or they would all start on the same port
+    cSourcePool theSources( sources );
+    theSources.Slice( worker, workers );
+
+    // a connection flooded with frames takes its turn with the others
+    cFairScheduler theScheduler( io_service );
+    std::vector< cNonBlockingTCPClient * > theClients;
+    for( int k = 0; k < connections; k++ )
     {
-        std::cout << "Error in read command\n";
+        // clients are cache line aligned, which plain new does not honour before C++17
+        void * p = 0;
+        if( posix_memalign( &p, alignof( cNonBlockingTCPClient ), sizeof( cNonBlockingTCPClient )))
+            break;
+        theClients.push_back( new( p ) cNonBlockingTCPClient( io_service, &theArena, &theTable, &thePool ));
+
+        // frames are only counted
+        theClients.back()->FrameHandler(
+            []( int, const std::vector< boost::asio::mutable_buffer >&, std::size_t ) {} );
+        theClients.back()->SourcePool( &theSources );
+        theClients.back()->FairScheduler( &theScheduler );
+        theClients.back()->Connect( ip, port );
+        if( theClients.back()->IsConnected() )
+            theClients.back()->ReadFrames();
     }
-    if( byte_count > MAX_PACKET_SIZE_BYTES )
+
+    if( theClients.size() )
+        std::cout << "Prefork worker " << worker << " per-connection footprint "
+                  << theClients[0]->Footprint() << " bytes\n";
+
+    // release the buffers of quiet connections, and close those quiet too long
+    std::unique_ptr< cIdleReaper > theReaper;
+    if( idle_msecs )
+        theReaper.reset( new cIdleReaper( io_service, theTable, idle_msecs, ttl_msecs ));
+
+    // publish metrics every second, until no connection is left
+    event_timer_t timer( io_service );
+    std::function< void() > publish = [&]()
     {
-        std::cout << "Too many bytes requested\n";
-        return;
+        unsigned long long bytes_read = 0, bytes_written = 0, frames_read = 0, frames_written = 0;
+        int connected = 0;
+        for( auto& c : theClients )
+        {
+            bytes_read += c->BytesRead();
+            bytes_written += c->BytesWritten();
+            frames_read += c->FramesRead();
+            frames_written += c->FramesWritten();
+            if( c->IsConnected() )
+                connected++;
+        }
+        metrics.myBytesRead.store( bytes_read, std::memory_order_relaxed );
+        metrics.myBytesWritten.store( bytes_written, std::memory_order_relaxed );
+        metrics.myFramesRead.store( frames_read, std::memory_order_relaxed );
+        metrics.myFramesWritten.store( frames_written, std::memory_order_relaxed );
+        metrics.myConnections.store( connected, std::memory_order_relaxed );
+        if( ! connected )
+        {
+            for( auto& c : theClients )
+                c->Close();
+            if( theReaper )
+                theReaper->Stop();
+            return;
+        }
+        timer.expires_from_now( boost::posix_time::seconds( 1 ));
+        timer.async_wait( [&]( const boost::system::error_code& )
+        {
+            publish();
+        });
+    };
+    publish();
+
+    io_service.run();
+    std::cout << "Prefork worker " << worker << " lost its connections\n";
+    for( auto c : theClients )
+    {
+        c->~cNonBlockingTCPClient();
+        free( c );
     }
-    async_read(
-        * mySocketTCP,
-        boost::asio::buffer(myRcvBuffer, byte_count ),
-        boost::bind(&cNonBlockingTCPClient::handle_read, this,
-                    boost::asio::placeholders::error,
-                    boost::asio::placeholders::bytes_transferred ));
-    std::cout << "waiting for server to reply\n";
+    return 1;
 }
 
-void cNonBlockingTCPClient::Write()
+#endif
+
+/** Run as supervisor of worker processes
+
+    'prefork <workers> <server ip> <server port> [--connections <N>] [--idle <msecs>] [--idle-ttl <msecs>]
+        [--source <ip,ip,...>] [--ports <first>-<last>]'
+
+    Each worker opens N connections, default 1, and reads frames from them.
+    Connections quiet for the idle time release their buffers, those quiet for the idle TTL are closed.
+    Runs until sent SIGINT or SIGTERM
+*/
+int PreforkMain( int argc, char* argv[] )
 {
-    if( myConnection != constatus::yes )
+#ifdef __linux__
+    int workers = argc < 5 ? 0 : atoi( argv[2] );
+    if( workers <= 0 )
     {
-        std::cout << "Write Request but no connection\n";
-        return;
+        std::cout << "usage: prefork <workers> <server ip> <server port> [--connections <N>]"
+                  " [--idle <msecs>] [--idle-ttl <msecs>] [--source <ip,ip,...>] [--ports <first>-<last>]\n";
+        return 1;
     }
-    boost::asio::async_write(
-        *mySocketTCP,
-        boost::asio::buffer(myWriteMessage, 15),
-        boost::bind(&cNonBlockingTCPClient::handle_write, this,
-                    boost::asio::placeholders::error,
-                    boost::asio::placeholders::bytes_transferred ));
+    int connections = 1;
+    std::string opt = OptionValue( argc, argv, "--connections" );
+    if( opt.length() )
+        connections = atoi( opt.c_str() );
+    unsigned int idle_msecs = 0;
+    opt = OptionValue( argc, argv, "--idle" );
+    if( opt.length() )
+        idle_msecs = atoi( opt.c_str() );
+    unsigned int ttl_msecs = 0;
+    opt = OptionValue( argc, argv, "--idle-ttl" );
+    if( opt.length() )
+        ttl_msecs = atoi( opt.c_str() );
+    std::string ip( argv[3] );
+    std::string port( argv[4] );
+    cSourcePool sources;
+    if( ! SourceOptions( argc, argv, sources ))
+        return 1;
+
+    cPrefork thePrefork(
+        workers,
+        [&]( int worker, sWorkerMetrics& metrics )
+    {
+        return PreforkWorker( worker, workers, metrics, ip, port, connections, idle_msecs, ttl_msecs, sources );
+    });
+    return thePrefork.Run();
+#else
+    std::cout << "prefork needs linux\n";
+    return 1;
+#endif
 }
 
-void cNonBlockingTCPClient::handle_read(
-    const boost::system::error_code& error,
-    std::size_t bytes_received )
+/** Run as monitor of another process's metrics page
+
+    'stat <path> [--interval <msecs>]'
+
+    Prints the metrics, and their rates, every interval, default one second.
+    Reads the page without any system call, so the monitored process is not disturbed.
+    Runs until killed, or the page goes away.
+*/
+int StatMain( int argc, char* argv[] )
 {
-    if( error )
+    if( argc < 3 )
     {
-        std::cout << "Connection closed\n";
-        myConnection = constatus::no;
-        return;
+        std::cout << "usage: stat <path> [--interval <msecs>]\n";
+        return 1;
+    }
+    int interval = 1000;
+    std::string opt = OptionValue( argc, argv, "--interval" );
+    if( opt.length() )
+        interval = atoi( opt.c_str() );
+    cMetricsPage thePage( argv[2], false );
+    if( ! thePage.IsOpen() )
+        return 1;
+
+    sMetrics previous;
+    if( ! thePage.Read( previous ))
+    {
+        std::cout << argv[2] << " is not a metrics page of this version\n";
+        return 1;
+    }
+    std::cout << "Metrics of process " << thePage.Writer() << "\n";
+    while( 1 )
+    {
+        std::this_thread::sleep_for( std::chrono::milliseconds( interval ));
+        sMetrics m;
+        if( ! thePage.Read( m ))
+            return 1;
+        double secs = ( m.myUpdateUsecs - previous.myUpdateUsecs ) / 1000000.0;
+        if( secs <= 0 )
+        {
+            std::cout << "no update\n";
+            continue;
+        }
+        std::cout << ( m.myConnected ? "connected" : "disconnected" )
+                  << " read " << m.myFramesRead << " frames "
+                  << (long long)(( m.myFramesRead - previous.myFramesRead ) / secs ) << "/s "
+                  << (long long)(( m.myBytesRead - previous.myBytesRead ) / secs ) << " B/s"
+                  << " written " << m.myFramesWritten << " frames "
+                  << (long long)(( m.myFramesWritten - previous.myFramesWritten ) / secs ) << "/s "
+                  << (long long)(( m.myBytesWritten - previous.myBytesWritten ) / secs ) << " B/s"
+                  << " queued " << m.myWriteQueue
+                  << " unacked " << m.myUnacknowledged
+                  << " requests " << m.myOutstanding
+                  << " cache " << m.myCacheHits << "/" << m.myCacheHits + m.myCacheMisses
+                  << "\n";
+        previous = m;
     }
-    std::cout << bytes_received << " bytes read\n";
-    for( int k = 0; k < bytes_received; k++ )
-        std::cout << std::hex << (int)myRcvBuffer[k] << " ";
-    std::cout << std::dec << "\n";
 }
 
-void cNonBlockingTCPClient::handle_connect_write(
-    const boost::system::error_code& error,
-    std::size_t bytes_sent )
+#ifdef __linux__
+
+/// resident memory of this process, bytes, 0 if unknown
+std::size_t ResidentBytes()
+{
+    std::ifstream statm( "/proc/self/statm" );
+    std::size_t pages = 0, resident = 0;
+    if( ! ( statm >> pages >> resident ))
+        return 0;
+    return resident * sysconf( _SC_PAGESIZE );
+}
+
+/** Run as benchmark of many mostly idle connections
+
+    'c100k <server ip> <server port> <connections> [--keepalive <msecs>] [--seconds <N>]
+        [--source <ip,ip,...>] [--ports <first>-<last>]'
+
+    Opens the connections with cCompactClient, holds them for N seconds, default 10,
+    sending keepalives on those quiet for the keepalive time, default 1000 msecs,
+    then reports the memory used per connection and the CPU cost of the keepalive sweeps.
+    Each connection is a socket, so the open file limit, ulimit -n, must allow for them.
+    More than about 28,000 connections to one server need more than one source address.
+*/
+int C100KMain( int argc, char* argv[] )
 {
-    if( error || bytes_sent != 15 )
+    if( argc < 5 )
     {
-        std::cout << "Error sending connection message to server\n";
-        myConnection = constatus::no;
-        return;
+        std::cout << "usage: c100k <server ip> <server port> <connections>"
+                  " [--keepalive <msecs>] [--seconds <N>] [--source <ip,ip,...>] [--ports <first>-<last>]\n";
+        return 1;
     }
-    std::cout << "Connection message sent to server\n";
+    int connections = atoi( argv[4] );
+    unsigned int keepalive = 1000;
+    std::string opt = OptionValue( argc, argv, "--keepalive" );
+    if( opt.length() )
+        keepalive = atoi( opt.c_str() );
+    int seconds = 10;
+    opt = OptionValue( argc, argv, "--seconds" );
+    if( opt.length() )
+        seconds = atoi( opt.c_str() );
+
+    boost::asio::io_service io_service;
+    cFrameSlotPool thePool( SHARED_SLOT_COUNT, MAX_PACKET_SIZE_BYTES );
+    cCompactClient theClient( io_service, thePool, keepalive );
+    cSourcePool theSources;
+    if( ! SourceOptions( argc, argv, theSources ))
+        return 1;
+    theClient.SourcePool( &theSources );
+
+    std::size_t before = ResidentBytes();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for( int k = 0; k < connections; k++ )
+    {
+        if( theClient.Connect( argv[2], argv[3] ) < 0 )
+            break;
+        if( ( k + 1 ) % 10000 == 0 )
+            std::cout << k + 1 << " connected\n";
+    }
+    std::size_t after = ResidentBytes();
+    int opened = theClient.Connections();
+    int open = opened;
+    std::cout << opened << " connections in "
+              << std::chrono::duration_cast< std::chrono::milliseconds >(
+                  std::chrono::steady_clock::now() - start ).count() << " msecs\n";
+    if( ! opened )
+        return 1;
+
+    event_timer_t theEnd( io_service );
+    theEnd.expires_from_now( boost::posix_time::seconds( seconds ));
+    theEnd.async_wait( [&]( const boost::system::error_code& )
+    {
+        open = theClient.Connections();
+        theClient.Stop();
+    });
+    io_service.run();
+
+    std::cout << "Slot table " << cCompactClient::BytesPerSlot() << " bytes per connection, "
+              << "resident memory grew " << ( after > before ? after - before : 0 ) / opened
+              << " bytes per connection, plus kernel socket state\n";
+    std::cout << open << " of " << opened << " connections still open, "
+              << theClient.FramesRead() << " frames read, "
+              << theClient.KeepalivesSent() << " keepalives sent\n";
+    if( theSources.Binds() )
+        std::cout << theSources.Binds() << " binds to source addresses, "
+                  << theSources.Collisions() << " source port collisions\n";
+    if( theClient.Sweeps() )
+        std::cout << theClient.Sweeps() << " keepalive sweeps, "
+                  << theClient.SweepNsecs() / theClient.Sweeps() / 1000.0 << " usecs CPU each, "
+                  << (double) theClient.SweepNsecs() / theClient.Sweeps() / open << " nsecs per connection\n";
+    return 0;
 }
 
-void cNonBlockingTCPClient::handle_write(
-    const boost::system::error_code& error,
-    std::size_t bytes_sent )
+#else
+
+int C100KMain( int argc, char* argv[] )
 {
-    if( error || bytes_sent != 15 )
+    std::cout << "c100k needs linux\n";
+    return 1;
+}
+
+#endif
+
+#ifdef __linux__
+
+/** Run as merger of feeds from several servers
+
+    'merge <ip>:<port>,<ip>:<port>,... [--lateness <usecs>] [--idle <msecs>] [--buffer <frames>] [--stamped]'
+
+    Reads frames from every server and merges them into one stream in timestamp order.
+    With --stamped a frame's timestamp is the first 8 bytes of its payload, usecs since 1970 big endian,
+    otherwise it is the time the frame was received.
+    Each source may deliver up to the lateness out of order, default 1000 usecs.
+    Reports every second the frames merged, those out of order, and those dropped as late.
+    Runs until every server has closed its connection.
+*/
+int MergeMain( int argc, char* argv[] )
+{
+    if( argc < 3 )
+    {
+        std::cout << "usage: merge <ip>:<port>,<ip>:<port>,... [--lateness <usecs>]"
+                  " [--idle <msecs>] [--buffer <frames>] [--stamped]\n";
+        return 1;
+    }
+    std::uint64_t lateness = 1000;
+    std::string opt = OptionValue( argc, argv, "--lateness" );
+    if( opt.length() )
+        lateness = atoll( opt.c_str() );
+    int idle_msecs = 100;
+    opt = OptionValue( argc, argv, "--idle" );
+    if( opt.length() )
+        idle_msecs = atoi( opt.c_str() );
+    std::size_t buffer_frames = 1024;
+    opt = OptionValue( argc, argv, "--buffer" );
+    if( opt.length() )
+        buffer_frames = atoi( opt.c_str() );
+
+    boost::asio::io_service io_service;
+    cFrameMerge theMerge( io_service, lateness, idle_msecs, buffer_frames );
+    if( HasOption( argc, argv, "--stamped" ) )
+        theMerge.Timestamp( [](
+                                int,
+                                const std::vector< boost::asio::mutable_buffer >& payload,
+                                std::size_t length )
+    {
+        unsigned char stamp[8] = { 0 };
+        if( length >= sizeof( stamp ))
+            boost::asio::buffer_copy( boost::asio::buffer( stamp ), payload, sizeof( stamp ));
+        std::uint64_t usecs = 0;
+        for( auto b : stamp )
+            usecs = ( usecs << 8 ) | b;
+        return usecs;
+    });
+
+    unsigned long long merged = 0, disorder = 0;
+    std::uint64_t last = 0;
+    theMerge.EmitHandler( [&]( cFrameMerge::sFrame& frame )
     {
-        std::cout << "Error sending write message to server\n";
-        myConnection = constatus::no;
-        return;
+        merged++;
+        if( frame.myTimestamp < last )
+            disorder++;
+        last = frame.myTimestamp;
+    });
+
+    // one connection to each server, each a source of the merge
+    std::vector< cNonBlockingTCPClient * > theClients;
+    std::stringstream ss( argv[2] );
+    std::string server;
+    while( std::getline( ss, server, ',' ))
+    {
+        std::size_t colon = server.rfind( ':' );
+        if( colon == std::string::npos )
+        {
+            std::cout << "Server " << server << " needs a port\n";
+            continue;
+        }
+
+        // clients are cache line aligned, which plain new does not honour before C++17
+        void * p = 0;
+        if( posix_memalign( &p, alignof( cNonBlockingTCPClient ), sizeof( cNonBlockingTCPClient )))
+            break;
+        cNonBlockingTCPClient * client = new( p ) cNonBlockingTCPClient( io_service );
+        client->FrameHandler( theMerge.Handler( theClients.size() ));
+        client->Connect( server.substr( 0, colon ), server.substr( colon + 1 ));
+        if( client->IsConnected() )
+            client->ReadFrames();
+        theClients.push_back( client );
     }
-    std::cout << "Write message sent to server\n";
+
+    // report every second, until no connection is left
+    event_timer_t timer( io_service );
+    std::function< void() > report = [&]()
+    {
+        int connected = 0;
+        for( auto& c : theClients )
+            if( c->IsConnected() )
+                connected++;
+        if( ! connected )
+        {
+            theMerge.Stop();
+            for( auto& c : theClients )
+                c->Close();
+        }
+        std::cout << "Merged " << merged << " frames from " << connected << " of " << theClients.size()
+                  << " servers, " << disorder << " out of order, " << theMerge.Late() << " late\n";
+        if( ! connected )
+            return;
+        timer.expires_from_now( boost::posix_time::seconds( 1 ));
+        timer.async_wait( [&]( const boost::system::error_code& )
+        {
+            report();
+        });
+    };
+    report();
+
+    io_service.run();
+    for( auto c : theClients )
+    {
+        c->~cNonBlockingTCPClient();
+        free( c );
+    }
+    return 0;
+}
+
+#else
+
+int MergeMain( int argc, char* argv[] )
+{
+    std::cout << "merge needs linux\n";
+    return 1;
+}
+
+#endif
+
+/** Run the timers in virtual time
+
+    'simulate <hours>'
+
+    Runs the work simulator for the given number of hours of virtual time,
+    jumping from each timer to the next, then reports the jobs completed
+    and the real time taken.
+*/
+int SimulateMain( int argc, char* argv[] )
+{
+    if( argc < 3 )
+    {
+        std::cout << "usage: simulate <hours>\n";
+        return 1;
+    }
+    double hours = atof( argv[2] );
+    cClock::UseVirtual( true );
+    boost::posix_time::ptime start = cClock::Now();
+    std::chrono::steady_clock::time_point real_start = std::chrono::steady_clock::now();
+
+    boost::asio::io_service io_service;
+    cWorkSimulator theWorkSimulator( io_service );
+
+    // jobs are counted, not printed
+    theWorkSimulator.WaitOnUserSet();
+    theWorkSimulator.StartWork();
+
+    // stop when the time is up
+    event_timer_t theEnd( io_service );
+    theEnd.expires_from_now( boost::posix_time::seconds( (long)( hours * 3600 )));
+    theEnd.async_wait( [&]( const boost::system::error_code& )
+    {
+        theWorkSimulator.Stop();
+    });
+
+    cClock::Run( io_service );
+
+    std::cout << "Simulated " << ( cClock::Now() - start ).total_seconds() << " secs, "
+              << theWorkSimulator.Jobs() << " jobs of " << WORK_TIME_MSECS << " msecs, in "
+              << std::chrono::duration_cast< std::chrono::milliseconds >(
+                  std::chrono::steady_clock::now() - real_start ).count()
+              << " msecs\n";
+    return 0;
 }
 
-int main()
+int main( int argc, char* argv[] )
 {
+    if( argc > 1 && std::string( argv[1] ) == "proxy" )
+        return ProxyMain( argc, argv );
+    if( argc > 1 && std::string( argv[1] ) == "netem" )
+        return NetemMain( argc, argv );
+    if( argc > 1 && std::string( argv[1] ) == "prefork" )
+        return PreforkMain( argc, argv );
+    if( argc > 1 && std::string( argv[1] ) == "stat" )
+        return StatMain( argc, argv );
+    if( argc > 1 && std::string( argv[1] ) == "c100k" )
+        return C100KMain( argc, argv );
+    if( argc > 1 && std::string( argv[1] ) == "simulate" )
+        return SimulateMain( argc, argv );
+    if( argc > 1 && std::string( argv[1] ) == "merge" )
+        return MergeMain( argc, argv );
+
+    // '--node' or '--nic' pins this thread, which runs the event manager, near the NIC
+    int node = NUMAHome( argc, argv );
+
+    // '--perf' counts cycles, instructions, cache and branch misses in each stage of the event manager thread
+    if( HasOption( argc, argv, "--perf" ) )
+        cPerfCounters::Open();
+
     // construct event manager
     boost::asio::io_service io_service;
 
     // construct work simulator
     cWorkSimulator theWorkSimulator( io_service );
 
+    // construct arena for receive buffers, local to the event manager thread
+    cBufferArena theArena( ARENA_BYTES, node );
+    std::cout << "Buffer arena backed by " << theArena.BackingText() << "\n";
+
+    // construct table of connections
+    cConnectionTable theTable;
+
     // construct TCP client
-    cNonBlockingTCPClient theClient( io_service );
+    cNonBlockingTCPClient theClient( io_service, &theArena, &theTable );
+    std::cout << "Per-connection footprint " << theClient.Footprint() << " bytes\n";
+
+    // '--source <ip,ip,...>' and '--ports <first>-<last>' choose the local address the connection is made from
+    cSourcePool theSources;
+    if( ! SourceOptions( argc, argv, theSources ))
+        return 1;
+    theClient.SourcePool( &theSources );
+
+    // '--resume' keeps frames until acknowledged and resends the gap after a reconnect
+    if( HasOption( argc, argv, "--resume" ) )
+        theClient.Resumable( true );
+
+    // '--timestamps' has the kernel timestamp traffic, separating network latency from processing latency
+    if( HasOption( argc, argv, "--timestamps" ) )
+        theClient.Timestamping( true );
+
+    // construct multiplexer of logical streams over the client's connection
+    cStreamMux theMux( theClient );
+
+    // construct group of connections that broadcasts go to
+    cBroadcast theBroadcast;
+    theBroadcast.Add( theClient );
+
+    // construct layer that merges identical requests in flight
+    cSingleFlight theSingleFlight( theClient );
+
+    // construct cache of responses, the text requests sent by the commander may be a second old
+    cResponseCache theCache( theSingleFlight, RESPONSE_CACHE_BYTES );
+    theCache.TTL( 0x8001, 1000, 5000 );
 
     // construct commander to dispatch commands from user in keyboard thread to TCP client in main thread
     cCommander theCommander(
         io_service,
-        theClient );
+        theClient,
+        theMux,
+        theBroadcast,
+        theCache );
 
     // start keyboard monitor
     cKeyboard theKeyBoard(
@@ -507,6 +1172,63 @@ int main()
         theCommander
     );
 
+    // '--upgrade <path>' takes over the connection of the process running before this one
+    // and hands it on to the process started after
+    std::string upgrade_path = OptionValue( argc, argv, "--upgrade" );
+    cHandoff theHandoff( io_service, upgrade_path );
+    if( upgrade_path.length() )
+    {
+        theHandoff.TakeOver( theClient );
+        theHandoff.Listen(
+            theClient,
+            [&io_service]
+        {
+            // the successor has the connection, this process is done
+            io_service.stop();
+        });
+    }
+
+    // '--metrics <path>' publishes metrics to a shared memory page, for 'stat <path>' to read
+    std::string metrics_path = OptionValue( argc, argv, "--metrics" );
+    std::unique_ptr< cMetricsPage > theMetrics;
+    event_timer_t theMetricsTimer( io_service );
+    std::function< void() > publish = [&]()
+    {
+        sMetrics m;
+        m.myUpdateUsecs = std::chrono::duration_cast< std::chrono::microseconds >(
+                              std::chrono::system_clock::now().time_since_epoch() ).count();
+        m.myBytesRead = theClient.BytesRead();
+        m.myBytesWritten = theClient.BytesWritten();
+        m.myFramesRead = theClient.FramesRead();
+        m.myFramesWritten = theClient.FramesWritten();
+        m.myConnected = theClient.IsConnected();
+        m.myWriteQueue = theClient.WriteQueueSize();
+        m.myUnacknowledged = theClient.Unacknowledged();
+        m.myOutstanding = theClient.Outstanding();
+        m.myCacheHits = theCache.Hits() + theCache.StaleHits();
+        m.myCacheMisses = theCache.Misses();
+        theMetrics->Publish( m );
+
+        // stop with the work, so the event manager can finish
+        if( theWorkSimulator.StopGet() )
+            return;
+        theMetricsTimer.expires_from_now( boost::posix_time::milliseconds( METRICS_PUBLISH_MSECS ));
+        theMetricsTimer.async_wait( [&]( const boost::system::error_code& error )
+        {
+            if( ! error )
+                publish();
+        });
+    };
+    if( metrics_path.length() )
+    {
+        theMetrics.reset( new cMetricsPage( metrics_path, true ));
+        if( theMetrics->IsOpen() )
+        {
+            std::cout << "Publishing metrics to " << metrics_path << "\n";
+            publish();
+        }
+    }
+
     // start simulating work
     theWorkSimulator.StartWork();
 
@@ -514,6 +1236,9 @@ int main()
     io_service.run();
 
     std::cout << "Event manager finished\n";
+    cPerfCounters::Report();
+    if( theClient.Timestamps() )
+        theClient.Timestamps()->Print();
 
     return 0;
 }